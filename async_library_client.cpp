@@ -0,0 +1,153 @@
+// Coroutine client for the library server API
+#include <stdlib.h>
+#include "async_library_client.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+AsyncLibraryClient::AsyncLibraryClient(Reactor &reactor, const string &host, int port, RateLimiter *limiter)
+    : reactor(reactor), own_balancer(make_unique<LoadBalancer>(host, port)), balancer(own_balancer.get()),
+      host(host), connections(1), limiter(limiter)
+{
+}
+
+AsyncLibraryClient::AsyncLibraryClient(Reactor &reactor, LoadBalancer &balancer, RateLimiter *limiter)
+    : reactor(reactor), balancer(&balancer), host(balancer.host()), connections(balancer.size()), limiter(limiter)
+{
+}
+
+/*  Send a request over the persistent connection and return its parsed response
+*   Waits on the reactor (not on the thread) for the rate limiter: until the
+*   next token, or until a permit gives a slot back
+*   The request goes to the replica picked by the balancer; a replica whose
+*   circuit breaker is open or that cannot be reached is skipped for the
+*   next one, and with every breaker open the request fails right away,
+*   without waiting for the rate limiter
+*/
+Task<Response> AsyncLibraryClient::exchange(char *message) {
+    optional<RateLimiter::Permit> permit;
+    Response response;
+
+    if (!balancer->available()) {
+        free(message);
+        co_return response;
+    }
+
+    while (limiter != NULL) {
+        microseconds wait;
+        optional<RateLimiter::Permit> acquired = limiter->try_acquire(wait, reactor.notify_fd());
+        if (acquired) {
+            permit.emplace(std::move(*acquired));
+            break;
+        }
+
+        if (wait == microseconds(0))
+            co_await reactor.notified();
+        else
+            co_await reactor.sleep(wait);
+    }
+
+    Endpoint *endpoint = NULL;
+    long ticket;
+    bool sent = false;
+    for (size_t tries = 0; tries < balancer->size(); ++tries) {
+        endpoint = tries == 0 ? &balancer->pick() : &balancer->next(*endpoint);
+        if (!endpoint->start(ticket))
+            continue;
+
+        sent = true;
+        unique_ptr<AsyncConnection> &connection = connections[balancer->index(*endpoint)];
+        if (!connection)
+            connection = make_unique<AsyncConnection>(reactor, endpoint->host, endpoint->port);
+
+        if (!connection->is_open() && !co_await connection->connect()) {
+            endpoint->finish(ticket, false);
+            continue;
+        }
+
+        response = co_await connection->request(message, strlen(message));
+        endpoint->finish(ticket, !is_replica_failure(response.http().status));
+        break;
+    }
+    free(message);
+
+    if (response.http().status != 0)
+        answered_requests++;
+    // Breakers that opened in the meantime say nothing of the server load
+    if (permit && sent)
+        permit->complete(!is_overloaded(response.http()));
+    else if (permit)
+        permit->cancel();
+    co_return response;
+}
+
+Task<Status> AsyncLibraryClient::registerUser(string username, string password) {
+    char *message = register_request(host, username, password);
+    if (message == NULL)
+        co_return Status::InvalidInput;
+
+    Response response = co_await exchange(message);
+    co_return register_status(response.http());
+}
+
+Task<Status> AsyncLibraryClient::login(string username, string password) {
+    char *message = login_request(host, username, password);
+    if (message == NULL)
+        co_return Status::InvalidInput;
+
+    Response response = co_await exchange(message);
+    co_return login_status(response.http(), cookie);
+}
+
+Task<Status> AsyncLibraryClient::enterLibrary() {
+    token.clear();
+    if (!loggedIn())
+        co_return Status::Unauthorized;
+
+    Response response = co_await exchange(access_request(host, session()));
+    co_return access_status(response.http(), token);
+}
+
+Task<Result<vector<Book>>> AsyncLibraryClient::getBooks() {
+    Result<vector<Book>> result = {Status::Ok, {}};
+
+    Response response = co_await exchange(books_request(host, jwt()));
+    result.status = books_status(response.http(), result.value);
+
+    co_return result;
+}
+
+Task<Result<Book>> AsyncLibraryClient::getBook(int id) {
+    Result<Book> result = {Status::Ok, {}};
+    result.value.id = id;
+
+    Response response = co_await exchange(book_request(host, id, jwt()));
+    result.status = book_status(response.http(), result.value);
+
+    co_return result;
+}
+
+Task<Status> AsyncLibraryClient::addBook(Book book) {
+    char *message = add_book_request(host, book, jwt());
+    if (message == NULL)
+        co_return Status::InvalidInput;
+
+    Response response = co_await exchange(message);
+    co_return add_book_status(response.http());
+}
+
+Task<Status> AsyncLibraryClient::deleteBook(int id) {
+    Response response = co_await exchange(delete_book_request(host, id, jwt()));
+    co_return delete_book_status(response.http());
+}
+
+/*  The cookie and the token are dropped whatever the server answers
+*/
+Task<Status> AsyncLibraryClient::logout() {
+    Response response = co_await exchange(logout_request(host, session()));
+
+    cookie.clear();
+    token.clear();
+
+    co_return logout_status(response.http());
+}
@@ -0,0 +1,79 @@
+#ifndef _ASYNC_LIBRARY_CLIENT_
+#define _ASYNC_LIBRARY_CLIENT_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "library_protocol.hpp"
+#include "load_balancer.hpp"
+#include "rate_limiter.hpp"
+#include "reactor.hpp"
+
+// coroutine flavour of LibraryClient: operations are awaited from a task
+// running on a Reactor and share one persistent non-blocking connection
+// per replica (e.g. co_await client.getBooks()); arguments are taken by
+// value since they must outlive the suspended call
+class AsyncLibraryClient {
+public:
+    // limiter may be shared by many clients, or NULL for no limit
+    AsyncLibraryClient(Reactor &reactor, const std::string &host, int port, RateLimiter *limiter = NULL);
+
+    // spreads the requests over the replicas of balancer, which may be
+    // shared with other clients (and threads) and must outlive this one
+    AsyncLibraryClient(Reactor &reactor, LoadBalancer &balancer, RateLimiter *limiter = NULL);
+
+    Task<Status> registerUser(std::string username, std::string password);
+
+    // logs in and keeps the session cookie
+    Task<Status> login(std::string username, std::string password);
+
+    // requests library access and keeps the JWT token
+    Task<Status> enterLibrary();
+
+    // returns the id and title of every book
+    Task<Result<std::vector<Book>>> getBooks();
+
+    Task<Result<Book>> getBook(int id);
+
+    // adds a book (the id is ignored)
+    Task<Status> addBook(Book book);
+
+    Task<Status> deleteBook(int id);
+
+    // logs out and forgets the cookie and the token
+    Task<Status> logout();
+
+    bool loggedIn() const { return !cookie.empty(); }
+    bool hasLibraryAccess() const { return !token.empty(); }
+
+    // takes over the cookie and token of a user that is already logged in
+    // (e.g. through a LibraryClient) instead of logging in again
+    void useSession(std::string session_cookie, std::string access_token) {
+        cookie = std::move(session_cookie);
+        token = std::move(access_token);
+    }
+
+    // requests the server answered (with any status) so far
+    long answered() const { return answered_requests; }
+
+private:
+    // sends a request (freeing it) and returns the parsed response, which
+    // is empty (status 0) if the server could not be reached
+    Task<Response> exchange(char *message);
+
+    const char *session() const { return cookie.empty() ? NULL : cookie.c_str(); }
+    const char *jwt() const { return token.empty() ? NULL : token.c_str(); }
+
+    Reactor &reactor;
+    std::unique_ptr<LoadBalancer> own_balancer;
+    LoadBalancer *balancer;
+    std::string host;
+    // indexed like the replicas of the balancer, opened on first use
+    std::vector<std::unique_ptr<AsyncConnection>> connections;
+    RateLimiter *limiter;
+    std::string cookie;
+    std::string token;
+    long answered_requests = 0;
+};
+
+#endif
@@ -0,0 +1,345 @@
+// Microbenchmarks of the request and response paths, run by make bench
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "library_client.hpp"
+
+extern "C" {
+  #include "content_decoding.h"
+  #include "helpers.h"
+}
+
+using namespace std;
+using namespace std::chrono;
+
+// Each benchmark repeats until it has run for at least this long
+#define MIN_BENCH_SECONDS 0.2
+
+// Sizes of the synthetic responses, from 1 KB to 100 MB
+static const size_t SIZES[] = {1 << 10, 64 << 10, 1 << 20, 16 << 20, 100 << 20};
+
+// Keeps the compiler from dropping the result of a benchmarked call
+static volatile long sink;
+
+/*  Loopback server answering every request with the same canned response,
+*   one request per connection like the real server
+*/
+class MockServer {
+public:
+    MockServer()
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (bind(fd, (struct sockaddr *) &addr, len) < 0 || listen(fd, 64) < 0)
+            error("ERROR starting mock server");
+
+        getsockname(fd, (struct sockaddr *) &addr, &len);
+        port = ntohs(addr.sin_port);
+        worker = thread(&MockServer::serve, this);
+    }
+
+    ~MockServer()
+    {
+        stopping = true;
+        // Wake up accept() with one last connection
+        close_connection(open_connection("127.0.0.1", port, AF_INET));
+        worker.join();
+        close(fd);
+    }
+
+    void respond_with(string response)
+    {
+        lock_guard<mutex> lock(response_mutex);
+        canned = std::move(response);
+    }
+
+    int port;
+
+private:
+    void serve()
+    {
+        char request[BUFLEN];
+
+        while (!stopping) {
+            int client = accept(fd, NULL, NULL);
+            if (client < 0)
+                continue;
+            if (stopping) {
+                close(client);
+                break;
+            }
+
+            // Read the request up to the end of its header, then its body
+            string received;
+            ssize_t bytes;
+            size_t header_end;
+            while ((header_end = received.find("\r\n\r\n")) == string::npos
+                   && (bytes = read(client, request, sizeof(request))) > 0)
+                received.append(request, bytes);
+            size_t length_at = received.find("Content-Length: ");
+            if (header_end != string::npos && length_at < header_end) {
+                size_t total = header_end + 4 + atol(received.c_str() + length_at + 16);
+                while (received.size() < total && (bytes = read(client, request, sizeof(request))) > 0)
+                    received.append(request, bytes);
+            }
+
+            lock_guard<mutex> lock(response_mutex);
+            size_t sent = 0;
+            while (sent < canned.size() && (bytes = send(client, canned.data() + sent, canned.size() - sent, MSG_NOSIGNAL)) > 0)
+                sent += bytes;
+            close(client);
+        }
+    }
+
+    int fd;
+    thread worker;
+    atomic<bool> stopping{false};
+    mutex response_mutex;
+    string canned;
+};
+
+/*  Run fn until MIN_BENCH_SECONDS passed and print one result line:
+*   benchmark, size in bytes, iterations, nanoseconds per call, MB/s
+*/
+static void bench(const string &name, size_t size, const function<void()> &fn) {
+    long iterations = 0;
+    auto start = steady_clock::now();
+    double elapsed;
+
+    do {
+        fn();
+        iterations++;
+        elapsed = duration<double>(steady_clock::now() - start).count();
+    } while (elapsed < MIN_BENCH_SECONDS);
+
+    double ns = elapsed * 1e9 / iterations;
+    double mb_per_s = size > 0 ? size / (ns / 1e9) / 1e6 : 0;
+    cout << name << "\t" << size << "\t" << iterations << "\t" << (long) ns << "\t" << (long) mb_per_s << endl;
+}
+
+static string http_response(const string &body) {
+    return "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: " + to_string(body.size())
+           + "\r\n\r\n" + body;
+}
+
+// Response with a gzip-encoded body, as a server answering Accept-Encoding sends it
+static string gzip_response(const string &body) {
+    z_stream stream = {};
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+
+    string encoded(deflateBound(&stream, body.size()), '\0');
+    stream.next_in = (Bytef *) body.data();
+    stream.avail_in = body.size();
+    stream.next_out = (Bytef *) encoded.data();
+    stream.avail_out = encoded.size();
+    deflate(&stream, Z_FINISH);
+    encoded.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    return "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Encoding: gzip\r\nContent-Length: "
+           + to_string(encoded.size()) + "\r\n\r\n" + encoded;
+}
+
+// Array of books like the one get_books receives, about size bytes long
+static string books_body(size_t size) {
+    string body = "[";
+    for (int id = 1; body.size() < size; ++id) {
+        if (id > 1)
+            body += ",";
+        body += "{\"id\":" + to_string(id) + ",\"title\":\"Title" + to_string(id) + "\"}";
+    }
+    return body + "]";
+}
+
+// One book whose title is padded so that the object is about size bytes long
+static string book_body(size_t size) {
+    string body = "{\"id\":1,\"title\":\"";
+    body.append(size > 128 ? size - 128 : 1, 'T');
+    return body + "\",\"author\":\"Author\",\"genre\":\"Genre\",\"page_count\":\"120\",\"publisher\":\"Publisher\"}";
+}
+
+// Response whose header is followed by size bytes of filler body
+static string filler_response(size_t size) {
+    return http_response(string(size, 'x'));
+}
+
+static void bench_buffers() {
+    for (size_t size : SIZES) {
+        string chunk(BUFLEN, 'x');
+        bench("buffer_add", size, [&] {
+            buffer b = buffer_init();
+            for (size_t added = 0; added < size; added += chunk.size())
+                buffer_add(&b, chunk.data(), chunk.size());
+            sink = b.size;
+            buffer_destroy(&b);
+        });
+
+        // The worst case for the header searches: the needle is at the end
+        buffer b = buffer_init();
+        string data = string(size, 'x') + "content-length\r\n\r\n";
+        buffer_add(&b, data.data(), data.size());
+        bench("buffer_find", size, [&] { sink = buffer_find(&b, "\r\n\r\n", 4); });
+        bench("buffer_find_insensitive", size, [&] { sink = buffer_find_insensitive(&b, "Content-Length", 14); });
+        bench("http_response_length", size, [&] { sink = http_response_length(&b); });
+        buffer_destroy(&b);
+    }
+}
+
+static void bench_requests() {
+    const char *cookies[1] = {"connect.sid=s%3Aabcdefghijklmnopqrstuvwxyz"};
+    string token(200, 't');
+    Book book = {0, "Title", "Author", "Genre", "Publisher", 120};
+
+    bench("compute_get_request", 0, [&] {
+        char *message = compute_get_request("127.0.0.1", API_PREFIX "/library/books", NULL, cookies, 1, token.c_str());
+        sink = message[0];
+        free(message);
+    });
+    bench("compute_post_request", 0, [&] {
+        char *message = compute_post_request("127.0.0.1", API_PREFIX "/auth/login", "application/json",
+                                             "{\"username\":\"user\",\"password\":\"pass\"}", 37, NULL, 0, NULL);
+        sink = message[0];
+        free(message);
+    });
+    bench("compute_delete_request", 0, [&] {
+        char *message = compute_delete_request("127.0.0.1", API_PREFIX "/library/books/1", NULL, NULL, 0, token.c_str());
+        sink = message[0];
+        free(message);
+    });
+    bench("add_book_request", 0, [&] {
+        char *message = add_book_request("127.0.0.1", book, token.c_str());
+        sink = message[0];
+        free(message);
+    });
+}
+
+static void bench_parsing() {
+    string access = http_response("{\"token\":\"" + string(200, 't') + "\"}");
+    bench("extract_token", access.size(), [&] {
+        string token;
+        sink = (long) access_status(parse_http_response(access), token);
+    });
+
+    for (size_t size : SIZES) {
+        string books = http_response(books_body(size));
+        bench("parse_books", size, [&] {
+            vector<Book> parsed;
+            books_status(parse_http_response(books), parsed);
+            sink = parsed.size();
+        });
+
+        string book = http_response(book_body(size));
+        bench("parse_book", size, [&] {
+            Book parsed = {};
+            book_status(parse_http_response(book), parsed);
+            sink = parsed.page_count;
+        });
+    }
+}
+
+/*  End-to-end over loopback: connect, send a request, read the whole response
+*/
+static void bench_loopback(MockServer &server) {
+    LibraryClient client("127.0.0.1", server.port);
+    char *message = compute_get_request("127.0.0.1", API_PREFIX "/library/books", NULL, NULL, 0, NULL);
+
+    for (size_t size : SIZES) {
+        server.respond_with(filler_response(size));
+        bench("receive_from_server", size, [&] {
+            int sockfd = open_connection("127.0.0.1", server.port, AF_INET);
+            send_to_server(sockfd, message);
+            size_t received;
+            free(receive_response(sockfd, &received));
+            close_connection(sockfd);
+            sink = received;
+        });
+
+        server.respond_with(http_response(books_body(size)));
+        bench("get_books", size, [&] { sink = client.getBooks().value.size(); });
+
+        // Same catalog inflated while it is received
+        server.respond_with(gzip_response(books_body(size)));
+        bench("get_books_gzip", size, [&] { sink = client.getBooks().value.size(); });
+
+        // Same catalog revalidated: one full response fills the cache, then
+        // the server only confirms it is unchanged
+        string full = http_response(books_body(size));
+        full.insert(full.find("\r\n") + 2, "ETag: \"v1\"\r\n");
+        server.respond_with(full);
+        client.getBooks();
+        server.respond_with("HTTP/1.1 304 Not Modified\r\nETag: \"v1\"\r\n\r\n");
+        bench("get_books_not_modified", size, [&] { sink = client.getBooks().value.size(); });
+
+        server.respond_with(http_response(book_body(size)));
+        bench("get_book", size, [&] { sink = client.getBook(1).value.page_count; });
+    }
+
+    free(message);
+}
+
+/*  Latency of small exchanges with and without TCP_NODELAY and TCP_QUICKACK.
+*   The split request sends its header and body in two writes, the pattern
+*   where Nagle's algorithm holds the body back until the header is acked.
+*/
+static void bench_socket_options(MockServer &server) {
+    LibraryClient client("127.0.0.1", server.port);
+    char *message = compute_post_request("127.0.0.1", API_PREFIX "/library/books", "application/json",
+                                         "{\"title\":\"Title\"}", 17, NULL, 0, NULL);
+    char *body = strstr(message, "\r\n\r\n") + 4;
+    string header(message, body);
+    server.respond_with(http_response(book_body(1 << 10)));
+
+    socket_options defaults = socket_options_get();
+    socket_options tuned = defaults;
+    tuned.nodelay = 1;
+    tuned.quickack = 1;
+
+    for (auto [suffix, options] : {make_pair("default", defaults), make_pair("nodelay_quickack", tuned)}) {
+        socket_options_set(&options);
+        bench(string("get_book_") + suffix, 1 << 10, [&] { sink = client.getBook(1).value.page_count; });
+        bench(string("split_request_") + suffix, 1 << 10, [&] {
+            int sockfd = open_connection("127.0.0.1", server.port, AF_INET);
+            send_to_server(sockfd, header.data());
+            send_to_server(sockfd, body);
+            size_t received;
+            free(receive_response(sockfd, &received));
+            close_connection(sockfd);
+            sink = received;
+        });
+    }
+
+    socket_options_set(&defaults);
+    free(message);
+}
+
+int main() {
+    const char *commit = getenv("BENCH_COMMIT");
+    if (commit != NULL && *commit != '\0')
+        cout << "# commit " << commit << endl;
+    cout << "# buffer_find " << buffer_find_impl() << endl;
+    cout << "benchmark\tsize_bytes\titerations\tns_per_op\tmb_per_s" << endl;
+
+    MockServer server;
+    bench_buffers();
+    bench_requests();
+    bench_parsing();
+    bench_loopback(server);
+    bench_socket_options(server);
+
+    return 0;
+}
@@ -0,0 +1,55 @@
+// Diff of successive book lists and the schedule of the watch polls
+#include <algorithm>
+#include "book_watcher.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+/*  One pass over the new list against the hash map of the old one; the
+*   books left in the old map afterwards are the removed ones
+*/
+BookChanges BookWatcher::update(const vector<Book> &books)
+{
+    BookChanges changes;
+    unordered_map<int, string> current;
+    current.reserve(books.size());
+
+    for (const Book &book : books) {
+        auto previous = known.find(book.id);
+        if (previous != known.end() && previous->second == book.title) {
+            current.emplace(book.id, std::move(previous->second));
+            known.erase(previous);
+            continue;
+        }
+
+        if (primed)
+            changes.added.push_back({book.id, book.title, "", "", "", 0});
+        current.emplace(book.id, book.title);
+    }
+
+    if (primed) {
+        for (auto &[id, title] : known)
+            changes.removed.push_back({id, std::move(title), "", "", "", 0});
+        sort(changes.removed.begin(), changes.removed.end(),
+             [](const Book &a, const Book &b) { return a.id < b.id; });
+    }
+
+    known = std::move(current);
+    primed = true;
+    return changes;
+}
+
+PollSchedule::PollSchedule(milliseconds interval, int max_backoff, double jitter)
+    : interval(interval), max_backoff(max(max_backoff, 1)), jitter(jitter), backoff(1),
+      random(random_device{}())
+{
+}
+
+milliseconds PollSchedule::next(bool changed)
+{
+    backoff = changed ? 1 : min(backoff * 2, max_backoff);
+    milliseconds delay = interval * backoff;
+
+    uniform_real_distribution<double> spread(1 - jitter, 1 + jitter);
+    return duration_cast<milliseconds>(delay * spread(random));
+}
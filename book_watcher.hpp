@@ -0,0 +1,52 @@
+#ifndef _BOOK_WATCHER_
+#define _BOOK_WATCHER_
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "library_protocol.hpp"
+
+// books that appeared and disappeared between two lists (a renamed book is
+// both removed and added)
+struct BookChanges {
+    std::vector<Book> added;
+    std::vector<Book> removed;
+
+    bool empty() const { return added.empty() && removed.empty(); }
+};
+
+// remembers the id and title of every book of the last list it saw
+class BookWatcher {
+public:
+    // compares books with the previous list and keeps them instead; the
+    // first list only sets the baseline (no changes)
+    BookChanges update(const std::vector<Book> &books);
+
+    size_t size() const { return known.size(); }
+
+private:
+    bool primed = false;
+    std::unordered_map<int, std::string> known;     // id -> title
+};
+
+// time between two polls: interval while the list changes, doubling up to
+// max_backoff times interval while it does not or the server fails, each
+// delay spread by +-jitter (a fraction) so that watchers drift apart
+class PollSchedule {
+public:
+    PollSchedule(std::chrono::milliseconds interval, int max_backoff = 8, double jitter = 0.2);
+
+    // delay before the next poll, after a poll that found changes or not
+    std::chrono::milliseconds next(bool changed);
+
+private:
+    std::chrono::milliseconds interval;
+    int max_backoff;
+    double jitter;
+    int backoff;
+    std::minstd_rand random;
+};
+
+#endif
@@ -0,0 +1,102 @@
+// In-memory catalog of books, stored column by column
+#include "catalog.hpp"
+
+using namespace std;
+
+uint32_t StringPool::intern(string_view s)
+{
+    auto it = codes.find(s);
+    if (it != codes.end())
+        return it->second;
+
+    uint32_t code = strings.size();
+    strings.emplace_back(s);
+    codes.emplace(strings.back(), code);
+    return code;
+}
+
+void StringPool::clear()
+{
+    codes.clear();
+    strings.clear();
+}
+
+/*  A new id gets a new row at the end of every column
+*   A known id is overwritten in place; its old title stays unused in title_data
+*/
+void Catalog::add(const Book &book)
+{
+    auto it = rows.find(book.id);
+    size_t row = it != rows.end() ? it->second : id_column.size();
+
+    if (row == id_column.size()) {
+        rows.emplace(book.id, row);
+        id_column.push_back(book.id);
+        page_count_column.push_back(0);
+        author_column.push_back(0);
+        genre_column.push_back(0);
+        publisher_column.push_back(0);
+        title_start.push_back(0);
+        title_length.push_back(0);
+    }
+
+    page_count_column[row] = book.page_count;
+    author_column[row] = author_pool.intern(book.author);
+    genre_column[row] = genre_pool.intern(book.genre);
+    publisher_column[row] = publisher_pool.intern(book.publisher);
+
+    title_start[row] = title_data.size();
+    title_length[row] = book.title.size();
+    title_data.insert(title_data.end(), book.title.begin(), book.title.end());
+}
+
+long Catalog::find(int id) const
+{
+    auto it = rows.find(id);
+    return it != rows.end() ? (long) it->second : -1;
+}
+
+Book Catalog::book(size_t row) const
+{
+    Book book;
+    book.id = id_column[row];
+    book.title = title(row);
+    book.author = author_pool[author_column[row]];
+    book.genre = genre_pool[genre_column[row]];
+    book.publisher = publisher_pool[publisher_column[row]];
+    book.page_count = page_count_column[row];
+    return book;
+}
+
+string_view Catalog::title(size_t row) const
+{
+    return string_view(title_data.data() + title_start[row], title_length[row]);
+}
+
+void Catalog::reserve(size_t count)
+{
+    id_column.reserve(count);
+    page_count_column.reserve(count);
+    author_column.reserve(count);
+    genre_column.reserve(count);
+    publisher_column.reserve(count);
+    title_start.reserve(count);
+    title_length.reserve(count);
+    rows.reserve(count);
+}
+
+void Catalog::clear()
+{
+    id_column.clear();
+    page_count_column.clear();
+    author_column.clear();
+    genre_column.clear();
+    publisher_column.clear();
+    title_data.clear();
+    title_start.clear();
+    title_length.clear();
+    author_pool.clear();
+    genre_pool.clear();
+    publisher_pool.clear();
+    rows.clear();
+}
@@ -0,0 +1,80 @@
+#ifndef _CATALOG_
+#define _CATALOG_
+
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "library_protocol.hpp"
+
+// distinct strings, each stored once and named by a dense code (0, 1, 2...)
+// in the order they were first seen
+class StringPool {
+public:
+    // returns the code of s, adding it if it is new
+    uint32_t intern(std::string_view s);
+
+    std::string_view operator[](uint32_t code) const { return strings[code]; }
+    size_t size() const { return strings.size(); }
+    void clear();
+
+private:
+    std::deque<std::string> strings;    // a deque never moves its strings
+    std::unordered_map<std::string_view, uint32_t> codes;
+};
+
+// books kept in memory as a structure of arrays: row i of every column
+// is one book. Ids and page counts are plain contiguous ints, author, genre
+// and publisher are codes of a string pool per column and the titles are
+// packed in one character array, so scanning a column touches nothing else
+class Catalog {
+public:
+    // adds a book, or replaces the one with the same id
+    void add(const Book &book);
+
+    // row of the book with the given id, or -1
+    long find(int id) const;
+
+    // the book stored in a row, as a standalone record
+    Book book(size_t row) const;
+
+    std::string_view title(size_t row) const;
+
+    size_t size() const { return id_column.size(); }
+    void reserve(size_t count);
+    void clear();
+
+    // columns
+    const std::vector<int> &ids() const { return id_column; }
+    const std::vector<int> &page_counts() const { return page_count_column; }
+    const std::vector<uint32_t> &authors() const { return author_column; }
+    const std::vector<uint32_t> &genres() const { return genre_column; }
+    const std::vector<uint32_t> &publishers() const { return publisher_column; }
+
+    // dictionaries of the coded columns
+    const StringPool &author_names() const { return author_pool; }
+    const StringPool &genre_names() const { return genre_pool; }
+    const StringPool &publisher_names() const { return publisher_pool; }
+
+private:
+    std::vector<int> id_column;
+    std::vector<int> page_count_column;
+    std::vector<uint32_t> author_column;
+    std::vector<uint32_t> genre_column;
+    std::vector<uint32_t> publisher_column;
+
+    // title of row i: title_data[title_start[i], title_start[i] + title_length[i])
+    std::vector<char> title_data;
+    std::vector<size_t> title_start;
+    std::vector<uint32_t> title_length;
+
+    StringPool author_pool;
+    StringPool genre_pool;
+    StringPool publisher_pool;
+
+    std::unordered_map<int, size_t> rows;   // id -> row
+};
+
+#endif
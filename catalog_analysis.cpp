@@ -0,0 +1,151 @@
+// Aggregations over the columns of the catalog
+#include <algorithm>
+#include <limits.h>
+#include "catalog_analysis.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Number of partial tables group_by spreads its updates over
+#define GROUP_LANES 4
+
+static ColumnStats stats_scalar(const int *values, size_t count)
+{
+    ColumnStats stats;
+    stats.count = count;
+    stats.min = INT_MAX;
+    stats.max = INT_MIN;
+
+    for (size_t i = 0; i < count; ++i) {
+        stats.sum += values[i];
+        stats.min = min(stats.min, values[i]);
+        stats.max = max(stats.max, values[i]);
+    }
+    return stats;
+}
+
+#if defined(__x86_64__)
+/*  Eight values per step: running min and max in 32-bit lanes, the sum in
+*   64-bit lanes so that millions of page counts cannot overflow it
+*/
+__attribute__((target("avx2")))
+static ColumnStats stats_avx2(const int *values, size_t count)
+{
+    __m256i sum = _mm256_setzero_si256();
+    __m256i low = _mm256_set1_epi32(INT_MAX);
+    __m256i high = _mm256_set1_epi32(INT_MIN);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (values + i));
+        low = _mm256_min_epi32(low, block);
+        high = _mm256_max_epi32(high, block);
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(block)));
+        sum = _mm256_add_epi64(sum, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(block, 1)));
+    }
+
+    // Fold the lanes together with the scalar tail
+    ColumnStats stats = stats_scalar(values + i, count - i);
+    stats.count = count;
+
+    long long sums[4];
+    int lows[8], highs[8];
+    _mm256_storeu_si256((__m256i *) sums, sum);
+    _mm256_storeu_si256((__m256i *) lows, low);
+    _mm256_storeu_si256((__m256i *) highs, high);
+
+    for (int lane = 0; lane < 4; ++lane)
+        stats.sum += sums[lane];
+    for (int lane = 0; lane < 8; ++lane) {
+        stats.min = min(stats.min, lows[lane]);
+        stats.max = max(stats.max, highs[lane]);
+    }
+    return stats;
+}
+#endif
+
+typedef ColumnStats (*StatsKernel)(const int *, size_t);
+
+static StatsKernel pick_kernel(const char **name)
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return stats_avx2;
+    }
+#endif
+    *name = "scalar";
+    return stats_scalar;
+}
+
+static const char *kernel_name;
+static StatsKernel kernel = pick_kernel(&kernel_name);
+
+ColumnStats column_stats(const vector<int> &values)
+{
+    if (values.empty())
+        return ColumnStats();
+    return kernel(values.data(), values.size());
+}
+
+const char *column_stats_impl()
+{
+    return kernel_name;
+}
+
+/*  Rows that follow each other often hit the same group (books of a genre
+*   are added together), which would make every update wait for the one
+*   before it; consecutive rows go to different partial tables instead and
+*   the tables are added up at the end
+*/
+GroupStats group_by(const vector<uint32_t> &codes, const vector<int> &page_counts, size_t groups)
+{
+    vector<long> counts(GROUP_LANES * groups, 0);
+    vector<long> sums(GROUP_LANES * groups, 0);
+    size_t rows = min(codes.size(), page_counts.size());
+    size_t i = 0;
+
+    for (; i + GROUP_LANES <= rows; i += GROUP_LANES) {
+        for (size_t lane = 0; lane < GROUP_LANES; ++lane) {
+            size_t slot = lane * groups + codes[i + lane];
+            counts[slot]++;
+            sums[slot] += page_counts[i + lane];
+        }
+    }
+    for (; i < rows; ++i) {
+        counts[codes[i]]++;
+        sums[codes[i]] += page_counts[i];
+    }
+
+    GroupStats stats;
+    stats.counts.assign(counts.begin(), counts.begin() + groups);
+    stats.page_sums.assign(sums.begin(), sums.begin() + groups);
+    for (size_t lane = 1; lane < GROUP_LANES; ++lane) {
+        for (size_t g = 0; g < groups; ++g) {
+            stats.counts[g] += counts[lane * groups + g];
+            stats.page_sums[g] += sums[lane * groups + g];
+        }
+    }
+    return stats;
+}
+
+vector<uint32_t> top_groups(const GroupStats &stats, size_t limit)
+{
+    // Codes of the dictionary no book of the catalog uses are left out
+    vector<uint32_t> order;
+    for (size_t g = 0; g < stats.counts.size(); ++g) {
+        if (stats.counts[g] > 0)
+            order.push_back(g);
+    }
+
+    limit = min(limit, order.size());
+    partial_sort(order.begin(), order.begin() + limit, order.end(), [&](uint32_t a, uint32_t b) {
+        return stats.counts[a] != stats.counts[b] ? stats.counts[a] > stats.counts[b] : a < b;
+    });
+    order.resize(limit);
+    return order;
+}
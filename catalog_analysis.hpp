@@ -0,0 +1,36 @@
+#ifndef _CATALOG_ANALYSIS_
+#define _CATALOG_ANALYSIS_
+
+#include <stdint.h>
+#include <vector>
+#include "catalog.hpp"
+
+// count, sum and range of an int column
+struct ColumnStats {
+    long count = 0;
+    long sum = 0;
+    int min = 0;            // 0 for an empty column, like max
+    int max = 0;
+
+    double average() const { return count > 0 ? (double) sum / count : 0; }
+};
+
+// number of books and of pages for every code of a dictionary column
+struct GroupStats {
+    std::vector<long> counts;
+    std::vector<long> page_sums;
+};
+
+// scans a column with AVX2 when the CPU has it
+ColumnStats column_stats(const std::vector<int> &values);
+
+// groups page_counts by codes (each below groups) in one pass
+GroupStats group_by(const std::vector<uint32_t> &codes, const std::vector<int> &page_counts, size_t groups);
+
+// codes of the (at most) limit largest non-empty groups, by count then by code
+std::vector<uint32_t> top_groups(const GroupStats &stats, size_t limit);
+
+// name of the column kernel in use: "avx2" or "scalar"
+const char *column_stats_impl();
+
+#endif
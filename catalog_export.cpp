@@ -0,0 +1,269 @@
+// Bulk export of the catalog to a file
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <charconv>
+#include "catalog_export.hpp"
+
+using namespace std;
+
+// Bytes gathered before each write(): large enough that a million rows
+// take a few hundred system calls
+#define EXPORT_BUFFER_SIZE (1 << 20)
+
+#define COLUMNAR_MAGIC "WLCATLG1"
+
+// Output file with one big buffer in front of it; the first failed write
+// is remembered and makes every later call a no-op
+class FileWriter {
+public:
+    explicit FileWriter(const string &path)
+        : fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+          data(NULL), used(0), written(0), error(fd < 0 ? errno : 0)
+    {
+        // Allocated after open() so that its errno is kept
+        data = (char *) malloc(EXPORT_BUFFER_SIZE);
+        if (data == NULL && error == 0)
+            error = ENOMEM;
+    }
+
+    ~FileWriter()
+    {
+        close();
+        free(data);
+    }
+
+    void write(const void *bytes, size_t size)
+    {
+        if (error != 0)
+            return;
+        if (used + size > EXPORT_BUFFER_SIZE) {
+            flush();
+            // Too big to be worth copying: straight to the file
+            if (size > EXPORT_BUFFER_SIZE) {
+                write_all((const char *) bytes, size);
+                return;
+            }
+        }
+        memcpy(data + used, bytes, size);
+        used += size;
+    }
+
+    void write(string_view s) { write(s.data(), s.size()); }
+
+    void put(char c)
+    {
+        if (error != 0)
+            return;
+        if (used == EXPORT_BUFFER_SIZE)
+            flush();
+        data[used++] = c;
+    }
+
+    void number(long value)
+    {
+        char digits[24];
+        char *end = to_chars(digits, digits + sizeof(digits), value).ptr;
+        write(digits, end - digits);
+    }
+
+    template <typename T>
+    void raw(const T &value) { write(&value, sizeof(value)); }
+
+    void flush()
+    {
+        write_all(data, used);
+        used = 0;
+    }
+
+    // flushes and closes the file; returns false if anything failed
+    bool close()
+    {
+        if (fd >= 0) {
+            flush();
+            if (::close(fd) < 0 && error == 0)
+                error = errno;
+            fd = -1;
+        }
+        if (error != 0)
+            errno = error;
+        return error == 0;
+    }
+
+    size_t size() const { return written + used; }
+
+private:
+    void write_all(const char *bytes, size_t size)
+    {
+        while (size > 0 && error == 0) {
+            ssize_t count = ::write(fd, bytes, size);
+            if (count < 0) {
+                if (errno != EINTR)
+                    error = errno;
+                continue;
+            }
+            bytes += count;
+            size -= count;
+            written += count;
+        }
+    }
+
+    int fd;
+    char *data;
+    size_t used;
+    size_t written;
+    int error;
+};
+
+bool parse_export_format(const string &name, ExportFormat &format) {
+    if (name == "csv")
+        format = ExportFormat::Csv;
+    else if (name == "jsonl")
+        format = ExportFormat::JsonLines;
+    else if (name == "columnar")
+        format = ExportFormat::Columnar;
+    else
+        return false;
+    return true;
+}
+
+/*  Quote a CSV field only if it holds a separator, a quote or a line break
+*/
+static void csv_field(FileWriter &out, string_view s) {
+    if (s.find_first_of(",\"\r\n") == string_view::npos) {
+        out.write(s);
+        return;
+    }
+
+    out.put('"');
+    for (char c : s) {
+        if (c == '"')
+            out.put('"');
+        out.put(c);
+    }
+    out.put('"');
+}
+
+static void json_string(FileWriter &out, string_view s) {
+    static const char hex[] = "0123456789abcdef";
+
+    out.put('"');
+    size_t clean = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = s[i];
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+
+        // Copy the run of plain characters before the escape in one go
+        out.write(s.substr(clean, i - clean));
+        clean = i + 1;
+        out.put('\\');
+        if (c == '"' || c == '\\') {
+            out.put(c);
+        } else if (c == '\n') {
+            out.put('n');
+        } else if (c == '\r') {
+            out.put('r');
+        } else if (c == '\t') {
+            out.put('t');
+        } else {
+            out.write("u00", 3);
+            out.put(hex[c >> 4]);
+            out.put(hex[c & 0xF]);
+        }
+    }
+    out.write(s.substr(clean));
+    out.put('"');
+}
+
+static void export_csv(const Catalog &catalog, FileWriter &out) {
+    out.write("id,title,author,genre,page_count,publisher\n");
+
+    for (size_t row = 0; row < catalog.size(); ++row) {
+        out.number(catalog.ids()[row]);
+        out.put(',');
+        csv_field(out, catalog.title(row));
+        out.put(',');
+        csv_field(out, catalog.author_names()[catalog.authors()[row]]);
+        out.put(',');
+        csv_field(out, catalog.genre_names()[catalog.genres()[row]]);
+        out.put(',');
+        out.number(catalog.page_counts()[row]);
+        out.put(',');
+        csv_field(out, catalog.publisher_names()[catalog.publishers()[row]]);
+        out.put('\n');
+    }
+}
+
+static void export_json_lines(const Catalog &catalog, FileWriter &out) {
+    for (size_t row = 0; row < catalog.size(); ++row) {
+        out.write("{\"id\":");
+        out.number(catalog.ids()[row]);
+        out.write(",\"title\":");
+        json_string(out, catalog.title(row));
+        out.write(",\"author\":");
+        json_string(out, catalog.author_names()[catalog.authors()[row]]);
+        out.write(",\"genre\":");
+        json_string(out, catalog.genre_names()[catalog.genres()[row]]);
+        out.write(",\"page_count\":");
+        out.number(catalog.page_counts()[row]);
+        out.write(",\"publisher\":");
+        json_string(out, catalog.publisher_names()[catalog.publishers()[row]]);
+        out.write("}\n");
+    }
+}
+
+static void dictionary_column(FileWriter &out, const StringPool &names, const vector<uint32_t> &codes) {
+    out.raw((uint32_t) names.size());
+    for (uint32_t code = 0; code < names.size(); ++code) {
+        out.raw((uint32_t) names[code].size());
+        out.write(names[code]);
+    }
+    out.write(codes.data(), codes.size() * sizeof(uint32_t));
+}
+
+/*  The int and code columns are written as they are in memory
+*/
+static void export_columnar(const Catalog &catalog, FileWriter &out) {
+    out.write(COLUMNAR_MAGIC, 8);
+    out.raw((uint64_t) catalog.size());
+
+    out.write(catalog.ids().data(), catalog.size() * sizeof(int32_t));
+    out.write(catalog.page_counts().data(), catalog.size() * sizeof(int32_t));
+    dictionary_column(out, catalog.author_names(), catalog.authors());
+    dictionary_column(out, catalog.genre_names(), catalog.genres());
+    dictionary_column(out, catalog.publisher_names(), catalog.publishers());
+
+    // Titles are packed again in row order, so replaced ones are left out
+    uint64_t offset = 0;
+    out.raw(offset);
+    for (size_t row = 0; row < catalog.size(); ++row) {
+        offset += catalog.title(row).size();
+        out.raw(offset);
+    }
+    for (size_t row = 0; row < catalog.size(); ++row)
+        out.write(catalog.title(row));
+}
+
+bool export_catalog(const Catalog &catalog, const string &path, ExportFormat format, size_t &bytes) {
+    FileWriter out(path);
+
+    switch (format) {
+    case ExportFormat::Csv:
+        export_csv(catalog, out);
+        break;
+    case ExportFormat::JsonLines:
+        export_json_lines(catalog, out);
+        break;
+    case ExportFormat::Columnar:
+        export_columnar(catalog, out);
+        break;
+    }
+
+    bool ok = out.close();
+    bytes = out.size();
+    return ok;
+}
@@ -0,0 +1,29 @@
+#ifndef _CATALOG_EXPORT_
+#define _CATALOG_EXPORT_
+
+#include <string>
+#include <string_view>
+#include "catalog.hpp"
+
+// file formats of export_catalog
+enum class ExportFormat {
+    Csv,            // header line, then one RFC 4180 row per book
+    JsonLines,      // one JSON object per line
+    Columnar        // the columns of the catalog as they are in memory, see below
+};
+
+// Columnar layout (native byte order):
+//   "WLCATLG1", uint64 rows
+//   int32 ids[rows], int32 page_counts[rows]
+//   author, genre, publisher: uint32 names, names x (uint32 length, bytes),
+//                             uint32 codes[rows]
+//   uint64 title_offsets[rows + 1], then the title bytes one after another
+
+// parses "csv", "jsonl" or "columnar"; returns false for anything else
+bool parse_export_format(const std::string &name, ExportFormat &format);
+
+// writes every book of the catalog to path and sets bytes to the file size;
+// returns false (with errno set) if the file cannot be written
+bool export_catalog(const Catalog &catalog, const std::string &path, ExportFormat format, size_t &bytes);
+
+#endif
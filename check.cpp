@@ -0,0 +1,1404 @@
+// Checks of the client state machines (circuit breaker transitions, the
+// replica picked by the load balancer, the rate limit and its wake-up, the
+// book list diff of watch, the resolver and the Happy Eyeballs connect
+// race), of the socket options, the io_uring transport, the thread pool,
+// the catalog, conditional GETs, the coroutine client, the sessions and
+// pipelining, and of the code parsing and writing data (buffer_find, HTTP
+// parser, Response, JSON reader and writer, export, gzip/deflate decoder,
+// traffic log); run by make check
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <tuple>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "async_library_client.hpp"
+#include "book_watcher.hpp"
+#include "catalog.hpp"
+#include "catalog_analysis.hpp"
+#include "catalog_export.hpp"
+#include "circuit_breaker.hpp"
+#include "http_response.hpp"
+#include "json_reader.hpp"
+#include "json_writer.hpp"
+#include "library_client.hpp"
+#include "library_protocol.hpp"
+#include "load_balancer.hpp"
+#include "rate_limiter.hpp"
+#include "session_manager.hpp"
+#include "thread_pool.hpp"
+
+extern "C" {
+  #include "content_decoding.h"
+  #include "helpers.h"
+  #include "resolver.h"
+  #include "traffic_log.h"
+  #include "transport.h"
+}
+
+using namespace std;
+using namespace std::chrono;
+
+// Picks drawn for each balancer check, enough for a random choice to show
+#define PICKS 1000
+
+static int checks = 0;
+static bool failed = false;
+
+static void check(bool ok, const string &what) {
+    checks++;
+    if (!ok) {
+        cout << "# FAILED: " << what << endl;
+        failed = true;
+    }
+}
+
+/*  Closed until failure_threshold failures in a row, open for open_time,
+*   then half-open with probes requests let through
+*/
+static void check_breaker_transitions() {
+    CircuitBreaker breaker(3, milliseconds(30), 2);
+    long ticket;
+
+    // A success in between starts the count again
+    for (bool ok : {false, false, true, false, false}) {
+        check(breaker.allow(ticket), "closed breaker lets requests through");
+        breaker.record(ticket, ok);
+    }
+    check(breaker.state() == CircuitBreaker::State::Closed, "closed below the threshold in a row");
+
+    check(breaker.allow(ticket), "closed breaker lets requests through");
+    breaker.record(ticket, false);
+    check(breaker.state() == CircuitBreaker::State::Open, "opens at the threshold");
+    check(!breaker.allow(ticket), "open breaker refuses requests");
+
+    this_thread::sleep_for(milliseconds(40));
+    long probes[2];
+    check(breaker.allow(probes[0]) && breaker.allow(probes[1]), "half-open breaker lets the probes through");
+    check(breaker.state() == CircuitBreaker::State::HalfOpen, "half-open after the open time");
+    check(!breaker.allow(ticket), "half-open breaker refuses requests past the probes");
+
+    breaker.record(probes[0], true);
+    check(breaker.state() == CircuitBreaker::State::HalfOpen, "stays half-open until every probe succeeded");
+    breaker.record(probes[1], true);
+    check(breaker.state() == CircuitBreaker::State::Closed, "closes once every probe succeeded");
+    check(breaker.allow(ticket), "closed again after the probes");
+    breaker.record(ticket, true);
+}
+
+/*  While half-open only the probes count: a request let through before
+*   the breaker opened and answering late changes nothing
+*/
+static void check_breaker_stale() {
+    CircuitBreaker breaker(1, milliseconds(20), 1);
+
+    long late, failing;
+    check(breaker.allow(late) && breaker.allow(failing), "closed breaker lets requests through");
+    breaker.record(failing, false);
+    check(breaker.state() == CircuitBreaker::State::Open, "a failure opens the breaker");
+
+    this_thread::sleep_for(milliseconds(30));
+    long probe;
+    check(breaker.allow(probe), "the probe goes through after the open time");
+
+    breaker.record(late, true);
+    check(breaker.state() == CircuitBreaker::State::HalfOpen, "a stale success does not close the breaker");
+    breaker.record(late, false);
+    check(breaker.state() == CircuitBreaker::State::HalfOpen, "a stale failure does not open the breaker");
+
+    breaker.record(probe, true);
+    check(breaker.state() == CircuitBreaker::State::Closed, "the probe closes the breaker");
+    breaker.record(late, false);
+    check(breaker.state() == CircuitBreaker::State::Closed, "a stale failure is not counted once closed");
+}
+
+/*  Each opening in a row lasts one open_time longer, up to max_open_time;
+*   a failed probe opens the breaker again
+*/
+static void check_breaker_backoff() {
+    milliseconds open_time(20);
+    CircuitBreaker breaker(1, open_time, 1, milliseconds(50));
+
+    for (milliseconds expected : {milliseconds(20), milliseconds(40), milliseconds(50), milliseconds(50)}) {
+        // Opened by the first failure, then by every failed probe
+        steady_clock::time_point opened = steady_clock::now();
+        long ticket;
+        check(breaker.allow(ticket), "a request (or probe) goes through before opening");
+        breaker.record(ticket, false);
+
+        check(breaker.state() == CircuitBreaker::State::Open, "a failure opens the breaker");
+        check(breaker.is_open(opened + expected - milliseconds(5)),
+              "open for " + to_string(expected.count()) + " ms");
+        check(!breaker.is_open(steady_clock::now() + expected + milliseconds(5)),
+              "open for no more than " + to_string(expected.count()) + " ms");
+
+        this_thread::sleep_for(expected + milliseconds(5));
+    }
+
+    // A success closes it and the next opening is the short one again
+    long ticket;
+    check(breaker.allow(ticket), "probe after the last opening");
+    breaker.record(ticket, true);
+    check(breaker.state() == CircuitBreaker::State::Closed, "a successful probe closes the breaker");
+    check(breaker.allow(ticket), "closed breaker lets requests through");
+    breaker.record(ticket, false);
+    check(!breaker.is_open(steady_clock::now() + open_time + milliseconds(5)), "backoff starts over after closing");
+}
+
+/*  Power of two choices: of two healthy replicas drawn at random the one
+*   with fewer outstanding requests is used
+*/
+static void check_balancer() {
+    LoadBalancer two({{"127.0.0.1", 1}, {"127.0.0.1", 2}});
+    long ticket;
+    two[0].start(ticket);
+
+    bool least_loaded = true;
+    for (int i = 0; i < PICKS; ++i)
+        least_loaded &= &two.pick() == &two[1];
+    check(least_loaded, "of two replicas the one with fewer outstanding requests");
+    two[0].finish(ticket, true);
+
+    // The most loaded replica loses every draw it is in
+    LoadBalancer three({{"127.0.0.1", 1}, {"127.0.0.1", 2}, {"127.0.0.1", 3}});
+    three[0].start(ticket);
+    three[0].start(ticket);
+    three[1].start(ticket);
+
+    vector<int> picked(three.size());
+    for (int i = 0; i < PICKS; ++i)
+        picked[three.index(three.pick())]++;
+    check(picked[0] == 0, "the most loaded of three replicas is never picked");
+    check(picked[1] > 0 && picked[2] > picked[1], "the least loaded of three replicas is picked most");
+
+    // A replica whose breaker opened is left out, then every replica when all are open
+    three.configure_breakers(1, milliseconds(60000), 1);
+    three[2].start(ticket);
+    three[2].finish(ticket, false);
+
+    bool skipped = true;
+    for (int i = 0; i < PICKS; ++i)
+        skipped &= &three.pick() != &three[2];
+    check(skipped, "a replica with an open breaker is not picked");
+
+    for (size_t i = 0; i < 2; ++i) {
+        three[i].start(ticket);
+        three[i].finish(ticket, false);
+    }
+    check(!three.available(), "with every breaker open no replica is available");
+    check(!three.pick().start(ticket), "with every breaker open the request fails right away");
+
+    check(&three.next(three[0]) == &three[1] && &three.next(three[2]) == &three[0],
+          "failover goes to the next replica in the list");
+}
+
+/*  The bucket gives burst tokens at once, then one per 1/rate; the limit
+*   halves on a drop, grows while latency stays flat and shrinks once it
+*   builds up
+*/
+static void check_rate_limiter() {
+    TokenBucket bucket(100, 3);
+    microseconds wait(0);
+    int taken = 0;
+    while (taken < 10 && bucket.try_acquire(wait))
+        taken++;
+    check(taken == 3, "the bucket lets a burst through");
+    check(wait > microseconds(0) && wait <= microseconds(10001), "the next token comes after 1/rate");
+    this_thread::sleep_for(wait);
+    check(bucket.try_acquire(wait), "a token after the wait");
+
+    ConcurrencyLimiter limiter(8, 1, 16);
+    bool slots = true;
+    for (int i = 0; i < 8; ++i)
+        slots &= limiter.try_acquire();
+    check(slots && !limiter.try_acquire() && limiter.in_flight() == 8, "no slot past the limit");
+
+    limiter.release(microseconds(1000), true);
+    check(limiter.limit() == 4, "a drop halves the limit");
+
+    // Flat latency with the limit in use: one more each time
+    for (int i = 0; i < 7; ++i)
+        limiter.release(microseconds(1000), false);
+    int grown = limiter.limit();
+    check(grown > 4, "flat latency grows the limit");
+
+    // Latency ten times the best: the server queues, so the limit shrinks
+    for (int i = 0; i < grown; ++i)
+        slots &= limiter.try_acquire();
+    check(slots, "slots up to the grown limit");
+    limiter.release(microseconds(10000), false);
+    check(limiter.limit() == grown - 1, "latency build-up shrinks the limit");
+
+    for (int i = 0; i < 5; ++i)
+        limiter.release(microseconds(1000), true);
+    check(limiter.limit() == 1, "drops stop at the minimum limit");
+}
+
+/*  A caller that cannot block and finds no free slot is woken up through
+*   its eventfd once a permit gives the slot back, completed or cancelled
+*/
+static void check_limiter_wakeup() {
+    RateLimiter limiter;
+    limiter.concurrency.configure(1, 1, 1);
+    int wake_fd = eventfd(0, EFD_NONBLOCK);
+    microseconds wait;
+    eventfd_t value;
+
+    optional<RateLimiter::Permit> first = limiter.try_acquire(wait, wake_fd);
+    check(first.has_value(), "the first permit is given right away");
+    check(!limiter.try_acquire(wait, wake_fd) && wait == microseconds(0), "no permit past the limit");
+    check(eventfd_read(wake_fd, &value) < 0, "not woken up while the slot is taken");
+
+    first->complete(true);
+    check(eventfd_read(wake_fd, &value) == 0, "woken up when a permit completes");
+
+    optional<RateLimiter::Permit> second = limiter.try_acquire(wait, wake_fd);
+    check(second.has_value() && !limiter.try_acquire(wait, wake_fd), "the slot given back is taken again");
+    second->cancel();
+    check(eventfd_read(wake_fd, &value) == 0, "woken up when a permit is cancelled");
+    check(eventfd_read(wake_fd, &value) < 0, "woken up once");
+
+    close(wake_fd);
+}
+
+// First position of needle in haystack, comparing letters without case
+static int naive_find(const string &haystack, const string &needle, bool insensitive) {
+    for (size_t i = 0; i + needle.size() <= haystack.size(); ++i) {
+        size_t j = 0;
+        while (j < needle.size() && (insensitive ? tolower(haystack[i + j]) == tolower(needle[j])
+                                                 : haystack[i + j] == needle[j]))
+            j++;
+        if (j == needle.size())
+            return i;
+    }
+    return -1;
+}
+
+/*  Every implementation of buffer_find the CPU has agrees with a plain
+*   search, for needles at every place around the vector width, and only
+*   folds the case of letters ('@' is not '`')
+*/
+static void check_buffer_find() {
+    const string alphabet = "aAbBzZ@`[{\r\n:";
+    minstd_rand random(7);
+
+    for (const char *impl : {"scalar", "sse2", "avx2"}) {
+        if (buffer_find_use(impl) < 0)
+            continue;
+
+        bool agrees = true;
+        for (int round = 0; round < 3000 && agrees; ++round) {
+            string haystack(random() % 100, ' ');
+            for (char &c : haystack)
+                c = alphabet[random() % alphabet.size()];
+            string needle(1 + random() % 6, ' ');
+            for (char &c : needle)
+                c = alphabet[random() % alphabet.size()];
+            // Half of the needles are taken from the haystack, anywhere up to its end
+            if (round % 2 == 0 && haystack.size() >= needle.size())
+                needle = haystack.substr(random() % (haystack.size() - needle.size() + 1), needle.size());
+
+            buffer text = buffer_init();
+            buffer_add(&text, haystack.data(), haystack.size());
+            agrees = buffer_find(&text, needle.data(), needle.size()) == naive_find(haystack, needle, false)
+                     && buffer_find_insensitive(&text, needle.data(), needle.size()) == naive_find(haystack, needle, true);
+            buffer_destroy(&text);
+        }
+        check(agrees, string("buffer_find (") + impl + ") agrees with a plain search");
+    }
+    buffer_find_use(NULL);
+}
+
+/*  Status line, headers (case-insensitive, trimmed), cookies, keep-alive
+*   and a body cut to Content-Length, from a single pass over the bytes
+*/
+static void check_http_parser() {
+    string raw = "HTTP/1.1 201 Created\r\n"
+                 "content-type:  application/json \r\n"
+                 "Set-Cookie: connect.sid=abc; Path=/; HttpOnly\r\n"
+                 "Set-Cookie: other=1\r\n"
+                 "Content-Length: 7\r\n"
+                 "\r\n"
+                 "{\"a\":1}HTTP/1.1 200 OK\r\n";
+    HttpResponse response = parse_http_response(raw);
+
+    check(response.status == 201 && response.reason == "Created" && response.ok(), "status line");
+    check(response.header("Content-Type") == "application/json", "header names are case-insensitive, values trimmed");
+    check(response.header("X-Missing").empty(), "a missing header is empty");
+    check(response.cookies.size() == 2 && response.cookie("connect.sid") == "connect.sid=abc",
+          "cookies without their attributes");
+    check(response.cookie("connect").empty(), "a cookie is found by its whole name");
+    check(response.body == "{\"a\":1}", "body cut to Content-Length, the next response left out");
+    check(response.keep_alive, "HTTP/1.1 keeps the connection by default");
+
+    response = parse_http_response("HTTP/1.1 200 OK\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+    check(response.status == 200 && !response.keep_alive, "Connection: close");
+
+    response = parse_http_response("HTTP/1.0 200 OK\r\nContent-Length: 2\r\n\r\nok");
+    check(!response.keep_alive, "HTTP/1.0 closes the connection by default");
+
+    response = parse_http_response("HTTP/1.1 200 OK\r\n\r\nuntil the end");
+    check(response.body == "until the end" && !response.keep_alive, "without a length the body ends with the connection");
+
+    response = parse_http_response("HTTP/1.1 304 Not Modified\r\nContent-Length: 12\r\n\r\n");
+    check(response.status == 304 && response.body.empty() && response.keep_alive, "304 has no body whatever its length");
+
+    for (const char *broken : {"", "HTTP/1.1 200 OK", "HTTP/1.1 2x0 OK\r\n\r\n", "HTTP/1.1 200 OK\r\nA: b\r\n",
+                               "SMTP 220 ready\r\n\r\n"})
+        check(parse_http_response(broken).status == 0, string("incomplete or broken header: ") + broken);
+}
+
+/*  A Response keeps the buffer it was read into: its views point into it,
+*   before and after a move, and the moved-from one is empty
+*/
+static void check_response_ownership() {
+    const char *text = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    char *data = strdup(text);
+    Response response(data, strlen(text));
+
+    check(response.raw().data() == data && response.http().body.data() == data + strlen(text) - 2,
+          "the response is parsed in place, not copied");
+
+    Response moved = std::move(response);
+    check(moved.raw().data() == data && moved.http().body == "ok", "the views stay valid after a move");
+    check(response.raw().empty() && response.http().status == 0, "a moved-from response is empty");
+
+    response = std::move(moved);
+    check(response.http().header("Content-Length") == "2", "moved back by assignment");
+}
+
+/*  Members found on demand: nested values skipped bracket by bracket,
+*   strings decoded with their escapes, counts sent as strings, and
+*   malformed text refused as a whole
+*/
+static void check_json_reader() {
+    JsonObject book(R"( {"id": 7, "nested": {"title": "no", "list": [1, "]"]}, "title": "A \"B\" \u00e9\ud83d\ude00",
+                         "page_count": "120", "author": null} )");
+    string title;
+    int id = 0, pages = 0;
+
+    check(book.valid(), "a well-formed object with spaces around it");
+    check(book.get_int("id", id) && id == 7, "integer member");
+    check(book.get_string("title", title) && title == "A \"B\" \xc3\xa9\xf0\x9f\x98\x80",
+          "escapes and surrogate pairs are decoded, the nested title is skipped");
+    check(book.find("nested") == R"({"title": "no", "list": [1, "]"]})", "a nested value is found whole");
+    check(!book.get_int("page_count", pages) && book.get_count("page_count", pages) && pages == 120,
+          "a count sent as a string");
+    check(book.find("author") == "null" && !book.get_string("author", title) && title.size() > 0,
+          "a member of another type leaves the output alone");
+    check(book.find("publisher").empty(), "a missing member");
+
+    for (const char *broken : {R"({"id": 7)", R"({"id": 7} {})", R"(["id"])", R"({"id": "7})", ""})
+        check(!JsonObject(broken).valid(), string("malformed object refused: ") + broken);
+
+    JsonArray books(R"([{"id": 1, "title": "[x]"}, {"id": 2}, 3])");
+    vector<string> elements;
+    string_view element;
+    while (books.next(element))
+        elements.emplace_back(element);
+    check(elements == vector<string>({R"({"id": 1, "title": "[x]"})", R"({"id": 2})", "3"}), "array elements in order");
+    check(!JsonArray("[1, 2").valid() && JsonArray("[]").valid(), "unterminated and empty arrays");
+}
+
+/*  The length counted before writing is the one written, and the request
+*   bodies read back with their values and a matching Content-Length
+*/
+static void check_json_writer() {
+    static constexpr const char *KEYS[] = {"a", "long_key"};
+    constexpr JsonSchema<2> schema(KEYS);
+
+    const string_view values[] = {"", "value"};
+    char out[64];
+    char *end = schema.write(out, values);
+    check(string(out, end) == R"({"a":"","long_key":"value"})" && (size_t) (end - out) == schema.length(values),
+          "object written with the length counted beforehand");
+
+    Book added = {0, "Title.1", "Au-thor", "genre_x", "Pub", 120};
+    char *message = add_book_request("host", added, "tok");
+    string request = message != NULL ? message : "";
+    free(message);
+
+    size_t body = request.find("\r\n\r\n");
+    JsonObject json(body != string::npos ? string_view(request).substr(body + 4) : "");
+    string title, publisher, page_count;
+    check(json.get_string("title", title) && title == added.title && json.get_string("publisher", publisher)
+          && publisher == added.publisher && json.get_string("page_count", page_count) && page_count == "120",
+          "book request body reads back, the page count as a string");
+    check(body != string::npos && request.find("Content-Length: " + to_string(request.size() - body - 4) + "\r\n") != string::npos,
+          "Content-Length of the body written");
+    check(request.find("Authorization: Bearer tok\r\n") != string::npos, "token sent with the book");
+
+    added.title = "needs \"escaping\"";
+    check(add_book_request("host", added, "tok") == NULL, "values that would need escaping are refused");
+
+    message = login_request("host", "user", "pass");
+    request = message != NULL ? message : "";
+    free(message);
+    check(request.ends_with("\r\n\r\n{\"username\":\"user\",\"password\":\"pass\"}"), "credentials body");
+}
+
+/*  Every task runs once; tasks a worker submits go to its own deque and
+*   idle workers steal them
+*/
+static void check_thread_pool() {
+    ThreadPool pool(4);
+
+    vector<atomic<int>> runs(PICKS);
+    pool.parallel_for(PICKS, [&](int i) { runs[i]++; });
+    bool once = true;
+    for (auto &count : runs)
+        once &= count == 1;
+    check(once, "parallel_for runs every index once");
+
+    // One task fans out slow ones on its own worker: the others must steal them
+    pool.reset_stats();
+    atomic<int> done(0);
+    pool.submit([&] {
+        for (int i = 0; i < 40; ++i) {
+            pool.submit([&] {
+                this_thread::sleep_for(milliseconds(1));
+                done++;
+            });
+        }
+    });
+    pool.wait();
+    check(done == 40, "wait returns once the tasks submitted by tasks finished");
+
+    long executed = 0, stolen = 0;
+    for (const ThreadPool::WorkerStats &worker : pool.stats()) {
+        executed += worker.executed;
+        stolen += worker.stolen;
+    }
+    check(executed == 41, "stats count every task");
+    check(stolen > 0, "idle workers steal from a busy one");
+}
+
+/*  Books go into the columns and come back the same; a book with an id
+*   already there replaces it, and equal names share a code
+*/
+static void check_catalog() {
+    Catalog catalog;
+    catalog.add({3, "First", "Ann", "sf", "Pub", 100});
+    catalog.add({5, "Second", "Bob", "sf", "Pub", 200});
+    catalog.add({3, "First, again", "Ann", "poetry", "Other", 50});
+
+    check(catalog.size() == 2 && catalog.find(3) == 0 && catalog.find(5) == 1 && catalog.find(4) == -1,
+          "one row per id, found by id");
+    Book first = catalog.book(0);
+    check(first.title == "First, again" && first.author == "Ann" && first.genre == "poetry"
+          && first.publisher == "Other" && first.page_count == 50, "a book with the same id replaces the row");
+    check(catalog.title(1) == "Second" && catalog.book(1).genre == "sf", "the other row is left alone");
+
+    check(catalog.authors()[0] != catalog.authors()[1] && catalog.author_names().size() == 2,
+          "one code per distinct author");
+    check(catalog.genre_names()[catalog.genres()[1]] == "sf" && catalog.genre_names().size() == 2,
+          "codes name their strings in the dictionary");
+
+    catalog.clear();
+    check(catalog.size() == 0 && catalog.find(3) == -1 && catalog.author_names().size() == 0, "clear empties everything");
+}
+
+/*  The vectorized column scan agrees with a plain loop at every length
+*   around the vector width, and groups add up per code
+*/
+static void check_catalog_analysis() {
+    minstd_rand random(42);
+    bool agrees = true;
+    for (size_t size : {0, 1, 7, 8, 9, 31, 33, 1000}) {
+        vector<int> values(size);
+        for (int &value : values)
+            value = (int) (random() % 20001) - 10000;
+
+        ColumnStats stats = column_stats(values);
+        ColumnStats expected;
+        for (int value : values) {
+            expected.min = expected.count == 0 ? value : min(expected.min, value);
+            expected.max = expected.count == 0 ? value : max(expected.max, value);
+            expected.sum += value;
+            expected.count++;
+        }
+        agrees &= stats.count == expected.count && stats.sum == expected.sum && stats.min == expected.min
+                  && stats.max == expected.max;
+    }
+    check(agrees, string("column stats (") + column_stats_impl() + ") agree with a plain loop");
+
+    GroupStats groups = group_by({2, 0, 2, 2, 0, 3}, {10, 20, 30, 40, 50, 60}, 5);
+    check(groups.counts == vector<long>({2, 0, 3, 1, 0}) && groups.page_sums == vector<long>({70, 0, 80, 60, 0}),
+          "books and pages per group");
+    check(top_groups(groups, 2) == vector<uint32_t>({2, 0}), "largest groups first");
+    check(top_groups(groups, 10) == vector<uint32_t>({2, 0, 3}), "empty groups are left out");
+
+    GroupStats ties = group_by({1, 0, 1, 0}, {1, 1, 1, 1}, 2);
+    check(top_groups(ties, 2) == vector<uint32_t>({0, 1}), "ties go by code");
+}
+
+static string read_file(const string &path) {
+    ifstream in(path, ios::binary);
+    stringstream contents;
+    contents << in.rdbuf();
+    return contents.str();
+}
+
+// Fields of the CSV rows of text, quotes undone
+static vector<vector<string>> csv_rows(const string &text) {
+    vector<vector<string>> rows(1, vector<string>(1));
+    bool quoted = false;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (quoted && c == '"' && i + 1 < text.size() && text[i + 1] == '"')
+            rows.back().back() += text[++i];
+        else if (c == '"')
+            quoted = !quoted;
+        else if (!quoted && c == ',')
+            rows.back().emplace_back();
+        else if (!quoted && c == '\n')
+            rows.emplace_back(1);
+        else
+            rows.back().back() += c;
+    }
+    rows.pop_back();
+    return rows;
+}
+
+// Reads the value at pos of a columnar file and moves past it
+template <typename T>
+static T columnar_read(const string &file, size_t &pos) {
+    T value = T();
+    if (pos + sizeof(T) <= file.size())
+        memcpy(&value, file.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+}
+
+static vector<string> columnar_dictionary(const string &file, size_t &pos, size_t rows) {
+    vector<string> names(columnar_read<uint32_t>(file, pos));
+    for (string &name : names) {
+        uint32_t length = columnar_read<uint32_t>(file, pos);
+        name = file.substr(min(pos, file.size()), length);
+        pos += length;
+    }
+
+    vector<string> column;
+    for (size_t row = 0; row < rows; ++row) {
+        uint32_t code = columnar_read<uint32_t>(file, pos);
+        column.push_back(code < names.size() ? names[code] : "");
+    }
+    return column;
+}
+
+// Books of a columnar file, in row order
+static vector<Book> columnar_books(const string &file) {
+    size_t pos = 8;
+    if (file.compare(0, 8, "WLCATLG1") != 0)
+        return {};
+
+    size_t rows = columnar_read<uint64_t>(file, pos);
+    vector<Book> books(rows);
+    for (Book &book : books)
+        book.id = columnar_read<int32_t>(file, pos);
+    for (Book &book : books)
+        book.page_count = columnar_read<int32_t>(file, pos);
+
+    vector<string> authors = columnar_dictionary(file, pos, rows);
+    vector<string> genres = columnar_dictionary(file, pos, rows);
+    vector<string> publishers = columnar_dictionary(file, pos, rows);
+
+    vector<uint64_t> offsets(rows + 1);
+    for (uint64_t &offset : offsets)
+        offset = columnar_read<uint64_t>(file, pos);
+    for (size_t row = 0; row < rows; ++row) {
+        books[row].author = authors[row];
+        books[row].genre = genres[row];
+        books[row].publisher = publishers[row];
+        books[row].title = file.substr(min(pos + offsets[row], file.size()), offsets[row + 1] - offsets[row]);
+    }
+    return pos + offsets[rows] == file.size() ? books : vector<Book>();
+}
+
+static bool same_book(const Book &a, const Book &b) {
+    return a.id == b.id && a.title == b.title && a.author == b.author && a.genre == b.genre
+           && a.page_count == b.page_count && a.publisher == b.publisher;
+}
+
+/*  Every format reads back to the books of the catalog, titles with
+*   separators, quotes, line breaks and control characters included
+*/
+static void check_export() {
+    Catalog catalog;
+    catalog.add({1, "Plain", "Ann", "sf", "Pub", 100});
+    catalog.add({2, "Quote \" and, comma", "Bob \"B\"", "sf", "Pub, Inc", 200});
+    catalog.add({3, "Line\nbreak\r\tand \x01", "Ann", "back\\slash", "", 0});
+    catalog.add({1, "Plain, replaced", "Ann", "poetry", "Pub", 150});
+
+    char path[] = "/tmp/check_export_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        close(fd);
+
+    size_t bytes;
+    bool written = export_catalog(catalog, path, ExportFormat::Columnar, bytes);
+    string file = read_file(path);
+    vector<Book> books = columnar_books(file);
+    bool same = written && bytes == file.size() && books.size() == catalog.size();
+    for (size_t row = 0; same && row < books.size(); ++row)
+        same = same_book(books[row], catalog.book(row));
+    check(same, "columnar export reads back to the catalog");
+
+    written = export_catalog(catalog, path, ExportFormat::JsonLines, bytes);
+    file = read_file(path);
+    same = written && bytes == file.size() && count(file.begin(), file.end(), '\n') == (long) catalog.size();
+    stringstream lines(file);
+    string line;
+    for (size_t row = 0; same && getline(lines, line); ++row) {
+        JsonObject json(line);
+        Book book;
+        same = json.get_int("id", book.id) && json.get_string("title", book.title)
+               && json.get_string("author", book.author) && json.get_string("genre", book.genre)
+               && json.get_int("page_count", book.page_count) && json.get_string("publisher", book.publisher)
+               && same_book(book, catalog.book(row));
+    }
+    check(same, "JSON lines export reads back to the catalog");
+
+    written = export_catalog(catalog, path, ExportFormat::Csv, bytes);
+    file = read_file(path);
+    vector<vector<string>> rows = csv_rows(file);
+    same = written && bytes == file.size() && rows.size() == catalog.size() + 1
+           && rows[0] == vector<string>({"id", "title", "author", "genre", "page_count", "publisher"});
+    for (size_t row = 0; same && row < catalog.size(); ++row) {
+        const vector<string> &fields = rows[row + 1];
+        Book book = catalog.book(row);
+        same = fields == vector<string>({to_string(book.id), book.title, book.author, book.genre,
+                                         to_string(book.page_count), book.publisher});
+    }
+    check(same, "CSV export reads back to the catalog");
+    unlink(path);
+
+    errno = 0;
+    check(!export_catalog(catalog, "/nonexistent/dir/out.csv", ExportFormat::Csv, bytes) && errno == ENOENT,
+          "an export that cannot be written fails with errno set");
+}
+
+// data compressed by zlib, window_bits picking the wrapper like deflateInit2
+static string compressed(const string &data, int window_bits) {
+    z_stream stream = {};
+    deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY);
+
+    string out(deflateBound(&stream, data.size()) + 32, '\0');
+    stream.next_in = (Bytef *) data.data();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef *) out.data();
+    stream.avail_out = out.size();
+    deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return out;
+}
+
+/*  Feeds raw to a decoder step bytes at a time, as a receive loop would,
+*   and returns the decoded response; status is set to the first failure
+*   (-1), 0 if the body was not encoded or 1 once decoded
+*/
+static string decode(const string &raw, size_t step, int &status) {
+    buffer received = buffer_init();
+    buffer_add(&received, raw.data(), raw.size());
+
+    body_decoder decoder;
+    status = body_decoder_start(&decoder, &received);
+    for (size_t end = step; status == 1 && end < raw.size() + step; end += step) {
+        if (body_decoder_update(&decoder, &received, min(end, raw.size())) < 0) {
+            body_decoder_abort(&decoder);
+            status = -1;
+        }
+    }
+
+    string result;
+    buffer decoded;
+    if (status == 1 && body_decoder_finish(&decoder, &decoded) < 0)
+        status = -1;
+    else if (status == 1) {
+        result.assign(decoded.data, decoded.size);
+        buffer_destroy(&decoded);
+    }
+    buffer_destroy(&received);
+    return result;
+}
+
+/*  gzip, zlib-wrapped deflate and raw deflate (the fallback for servers
+*   that leave the wrapper out) inflate to the same response, however the
+*   body is split; broken or cut bodies fail
+*/
+static void check_content_decoding() {
+    string body = "[";
+    for (int i = 0; i < 200; ++i)
+        body += (i > 0 ? "," : "") + string(R"({"id":)") + to_string(i) + R"(,"title":"Book )" + to_string(i % 7) + "\"}";
+    body += "]";
+
+    for (auto [encoding, window_bits, name] : {make_tuple("gzip", 16 + MAX_WBITS, "gzip"),
+                                               make_tuple("deflate", MAX_WBITS, "deflate"),
+                                               make_tuple("deflate", -MAX_WBITS, "raw deflate")}) {
+        string packed = compressed(body, window_bits);
+        string raw = "HTTP/1.1 200 OK\r\nContent-Encoding: " + string(encoding) + "\r\nContent-Length: "
+                     + to_string(packed.size()) + "\r\nContent-Type: application/json\r\n\r\n" + packed;
+
+        for (size_t step : {(size_t) 1, (size_t) 7, raw.size()}) {
+            int status;
+            string decoded = decode(raw, step, status);
+            HttpResponse response = parse_http_response(decoded);
+            check(status == 1 && response.body == body && response.header("Content-Encoding").empty()
+                  && response.header("Content-Length") == to_string(body.size())
+                  && response.header("Content-Type") == "application/json",
+                  string(name) + " body inflated in pieces of " + to_string(step));
+        }
+
+        int status;
+        decode(raw.substr(0, raw.size() - 4), raw.size(), status);
+        check(status == -1, string(name) + " body cut short fails");
+
+        // A block type that does not exist
+        string broken = raw;
+        broken[raw.size() - packed.size()] = 0x07;
+        decode(broken, raw.size(), status);
+        check(status == -1, string(name) + " broken body fails");
+
+        // Only the wrapped formats carry a checksum of the data
+        if (window_bits > 0) {
+            broken = raw;
+            broken[raw.size() - packed.size() / 2] ^= 0x55;
+            decode(broken, raw.size(), status);
+            check(status == -1, string(name) + " body changed in the middle fails its checksum");
+        }
+    }
+
+    int status;
+    decode("HTTP/1.1 200 OK\r\nContent-Encoding: identity\r\nContent-Length: 2\r\n\r\nok", 1, status);
+    check(status == 0, "an identity body is left alone");
+    decode("HTTP/1.1 304 Not Modified\r\nContent-Encoding: gzip\r\n\r\n", 1, status);
+    check(status == 0, "a 304 has no body to decode");
+}
+
+static Book book(int id, const string &title) {
+    return {id, title, "", "", "", 0};
+}
+
+static bool same_ids(const vector<Book> &books, const vector<int> &ids) {
+    if (books.size() != ids.size())
+        return false;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (books[i].id != ids[i])
+            return false;
+    }
+    return true;
+}
+
+/*  Books added and removed between two lists
+*/
+static void check_watcher() {
+    BookWatcher watcher;
+
+    BookChanges changes = watcher.update({book(1, "A"), book(2, "B"), book(3, "C")});
+    check(changes.empty() && watcher.size() == 3, "the first list only sets the baseline");
+
+    changes = watcher.update({book(3, "C"), book(1, "A"), book(2, "B")});
+    check(changes.empty(), "the same books in another order are no change");
+
+    changes = watcher.update({book(1, "A"), book(3, "C2"), book(4, "D")});
+    check(same_ids(changes.added, {3, 4}), "new and renamed books are added");
+    check(same_ids(changes.removed, {2, 3}), "gone and renamed books are removed, by id");
+    check(changes.removed.size() == 2 && changes.removed[1].title == "C", "a removed book keeps its old title");
+
+    changes = watcher.update({});
+    check(changes.added.empty() && same_ids(changes.removed, {1, 3, 4}), "an empty list removes every book");
+    check(watcher.size() == 0, "nothing is kept after an empty list");
+}
+
+/*  The delay doubles while nothing changes, up to max_backoff times the
+*   interval, and is back to the interval after a change
+*/
+static void check_poll_schedule() {
+    PollSchedule exact(milliseconds(100), 8, 0);
+
+    vector<long> delays;
+    for (bool changed : {false, false, false, false, false, true, false})
+        delays.push_back(exact.next(changed).count());
+    check(delays == vector<long>({200, 400, 800, 800, 800, 100, 200}), "backoff doubles up to 8 times and resets");
+
+    PollSchedule spread(milliseconds(100), 8, 0.2);
+    bool within = true;
+    for (int i = 0; i < PICKS; ++i) {
+        long delay = spread.next(true).count();
+        within &= delay >= 80 && delay <= 120;
+    }
+    check(within, "jitter stays within 20% of the delay");
+}
+
+static resolved_address loopback(int port) {
+    resolved_address address = {};
+    struct sockaddr_in *v4 = (struct sockaddr_in *) &address.addr;
+    v4->sin_family = AF_INET;
+    v4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    v4->sin_port = htons(port);
+    address.length = sizeof(*v4);
+    return address;
+}
+
+static int local_port(int sockfd) {
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    getsockname(sockfd, (struct sockaddr *) &addr, &length);
+    return ntohs(addr.sin_port);
+}
+
+static int peer_port(int sockfd) {
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    if (getpeername(sockfd, (struct sockaddr *) &addr, &length) < 0)
+        return -1;
+    return ntohs(addr.sin_port);
+}
+
+// Listening socket on a free loopback port, backlog as given
+static int listener(int backlog) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    resolved_address any = loopback(0);
+    bind(fd, (struct sockaddr *) &any.addr, any.length);
+    listen(fd, backlog);
+    return fd;
+}
+
+static int socket_option(int sockfd, int level, int name) {
+    int value = -1;
+    socklen_t length = sizeof(value);
+    getsockopt(sockfd, level, name, &value, &length);
+    return value;
+}
+
+/*  The options set are on every connection opened afterwards, Fast Open
+*   included for a host with a single address
+*/
+static void check_socket_options() {
+    int server = listener(4);
+    socket_options defaults = socket_options_get();
+
+    int sockfd = open_connection("127.0.0.1", local_port(server), AF_INET);
+    check(sockfd >= 0 && socket_option(sockfd, IPPROTO_TCP, TCP_NODELAY) == 0, "no option by default");
+    if (sockfd >= 0)
+        close_connection(sockfd);
+
+    socket_options tuned = defaults;
+    tuned.nodelay = 1;
+    tuned.rcvbuf = 256 * 1024;
+    tuned.sndbuf = 128 * 1024;
+    tuned.fastopen = 1;
+    socket_options_set(&tuned);
+
+    sockfd = open_connection("127.0.0.1", local_port(server), AF_INET);
+    check(sockfd >= 0 && socket_option(sockfd, IPPROTO_TCP, TCP_NODELAY) == 1, "TCP_NODELAY");
+    // The kernel doubles the buffer sizes asked for
+    check(socket_option(sockfd, SOL_SOCKET, SO_RCVBUF) >= tuned.rcvbuf
+          && socket_option(sockfd, SOL_SOCKET, SO_SNDBUF) >= tuned.sndbuf, "buffer sizes");
+    check(socket_option(sockfd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT) == 1, "Fast Open for a single address");
+    if (sockfd >= 0)
+        close_connection(sockfd);
+
+    socket_options_set(&defaults);
+    close(server);
+}
+
+static int address_port(const resolved_address &address) {
+    return ntohs(((const struct sockaddr_in *) &address.addr)->sin_port);
+}
+
+/*  Endpoints written as host, host:port and [ipv6]:port, and literals
+*   resolved within their family with the port set
+*/
+static void check_resolver() {
+    char host[64];
+    int port = 80;
+    check(parse_endpoint("example.org", host, sizeof(host), &port) == 0 && string(host) == "example.org" && port == 80,
+          "a host alone keeps the port");
+    check(parse_endpoint("example.org:8081", host, sizeof(host), &port) == 0 && string(host) == "example.org"
+          && port == 8081, "host:port");
+    check(parse_endpoint("[::1]:9000", host, sizeof(host), &port) == 0 && string(host) == "::1" && port == 9000,
+          "[ipv6]:port");
+    port = 80;
+    check(parse_endpoint("fe80::1", host, sizeof(host), &port) == 0 && string(host) == "fe80::1" && port == 80,
+          "a bare IPv6 address has no port");
+    for (const char *broken : {"", ":80", "host:", "host:0", "host:65536", "host:8x", "[::1", "[::1]x", "[]:80"})
+        check(parse_endpoint(broken, host, sizeof(host), &port) < 0, string("malformed endpoint: ") + broken);
+
+    resolved_address addresses[RESOLVER_MAX_ADDRESSES];
+    check(resolver_lookup("127.0.0.1", 8080, AF_UNSPEC, addresses, RESOLVER_MAX_ADDRESSES) == 1
+          && addresses[0].addr.ss_family == AF_INET && address_port(addresses[0]) == 8080, "IPv4 literal with its port");
+    check(resolver_lookup("::1", 8080, AF_UNSPEC, addresses, RESOLVER_MAX_ADDRESSES) == 1
+          && addresses[0].addr.ss_family == AF_INET6
+          && ntohs(((struct sockaddr_in6 *) &addresses[0].addr)->sin6_port) == 8080, "IPv6 literal with its port");
+    check(resolver_lookup("127.0.0.1", 8080, AF_INET6, addresses, RESOLVER_MAX_ADDRESSES) < 0,
+          "a literal of another family is not an address");
+
+    int count = resolver_lookup("localhost", 81, AF_INET, addresses, RESOLVER_MAX_ADDRESSES);
+    bool all = count > 0;
+    for (int i = 0; i < count; ++i)
+        all &= addresses[i].addr.ss_family == AF_INET && address_port(addresses[i]) == 81;
+    check(all, "names resolve within the family asked for, with the port set");
+    check(resolver_lookup("localhost", 82, AF_INET, addresses, 1) == 1 && address_port(addresses[0]) == 82,
+          "a cached name gets the port of the lookup, up to max addresses");
+}
+
+/*  A blackholed address (a listener whose accept queue is full drops the
+*   SYNs), one refusing connections and a working one: the race must end on
+*   the working one, also with Fast Open, and a refused attempt starts the
+*   next one without waiting for the stagger
+*/
+static void check_connect_race() {
+    int blackhole = listener(0);
+    int filler = socket(AF_INET, SOCK_STREAM, 0);
+    resolved_address full = loopback(local_port(blackhole));
+    connect(filler, (struct sockaddr *) &full.addr, full.length);
+
+    int closed = listener(1);
+    int refused_port = local_port(closed);
+    close(closed);
+
+    int working = listener(16);
+    int working_port = local_port(working);
+
+    socket_options defaults = socket_options_get();
+    socket_options fastopen = defaults;
+    fastopen.fastopen = 1;
+
+    for (auto [name, options] : {make_pair("", defaults), make_pair(" with fastopen", fastopen)}) {
+        socket_options_set(&options);
+
+        resolved_address addresses[] = {full, loopback(refused_port), loopback(working_port)};
+        auto start = steady_clock::now();
+        int sockfd = connect_addresses(addresses, 3);
+        milliseconds elapsed = duration_cast<milliseconds>(steady_clock::now() - start);
+
+        check(sockfd >= 0 && peer_port(sockfd) == working_port,
+              string("race past a blackholed address ends on the working one") + name);
+        // The refused attempt starts at the first stagger (250 ms) and the working one right after it
+        check(elapsed >= milliseconds(200) && elapsed < milliseconds(450),
+              string("a refused attempt starts the next one at once") + name + " (" +
+              to_string(elapsed.count()) + " ms)");
+        if (sockfd >= 0)
+            close(sockfd);
+    }
+
+    socket_options_set(&defaults);
+    close(filler);
+    close(blackhole);
+    close(working);
+}
+
+/*  Loopback server answering each request with the next of responses,
+*   over the connections the client opens, and keeping the requests
+*/
+static void serve(int listen_fd, vector<string> responses, vector<string> *requests) {
+    int fd = -1;
+    string pending;
+
+    for (const string &response : responses) {
+        size_t end;
+        while ((end = pending.find("\r\n\r\n")) == string::npos) {
+            char data[BUFLEN];
+            ssize_t bytes = fd >= 0 ? read(fd, data, sizeof(data)) : 0;
+            if (bytes > 0) {
+                pending.append(data, bytes);
+                continue;
+            }
+
+            if (fd >= 0)
+                close(fd);
+            pending.clear();
+            if ((fd = accept(listen_fd, NULL, NULL)) < 0)
+                return;
+        }
+
+        requests->push_back(pending.substr(0, end + 4));
+        pending.erase(0, end + 4);
+        send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+    }
+
+    if (fd >= 0)
+        close(fd);
+}
+
+static string reply(const string &status, const string &headers, const string &body) {
+    return "HTTP/1.1 " + status + "\r\n" + headers + "Content-Length: " + to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+/*  Once the server sent validators, get_books and get_book send them back
+*   and a 304 Not Modified is answered from the cache; a changed resource
+*   replaces the cached one
+*/
+static void check_conditional_get() {
+    const string date = "Last-Modified: Mon, 19 Oct 2026 10:00:00 GMT\r\n";
+    int server = listener(4);
+    vector<string> requests;
+    thread worker(serve, server, vector<string>({
+        reply("200 OK", "ETag: \"v1\"\r\n" + date, R"([{"id":1,"title":"A"}])"),
+        "HTTP/1.1 304 Not Modified\r\nETag: \"v1\"\r\n\r\n",
+        reply("200 OK", "ETag: \"v2\"\r\n", R"([{"id":1,"title":"A"},{"id":2,"title":"B"}])"),
+        reply("200 OK", "ETag: \"b1\"\r\n", R"({"id":1,"title":"A","author":"Ann","genre":"sf","page_count":"10","publisher":"P"})"),
+        "HTTP/1.1 304 Not Modified\r\n\r\n",
+    }), &requests);
+
+    LibraryClient client("127.0.0.1", local_port(server));
+    Result<vector<Book>> first = client.getBooks();
+    Result<vector<Book>> cached = client.getBooks();
+    Result<vector<Book>> changed = client.getBooks();
+    Result<Book> book = client.getBook(1);
+    Result<Book> same = client.getBook(1);
+    worker.join();
+    close(server);
+
+    auto sent = [&](size_t i, const string &line) {
+        return i < requests.size() && requests[i].find(line) != string::npos;
+    };
+    check(first.ok() && same_ids(first.value, {1}) && !sent(0, "If-None-Match"), "the first request is not conditional");
+    check(sent(1, "If-None-Match: \"v1\"\r\n") && sent(1, "If-Modified-Since: Mon, 19 Oct 2026 10:00:00 GMT\r\n"),
+          "the validators of the catalog are sent back");
+    check(cached.ok() && same_ids(cached.value, {1}) && cached.value[0].title == "A", "304 answered from the cache");
+    check(sent(2, "If-None-Match: \"v1\"\r\n") && changed.ok() && same_ids(changed.value, {1, 2}),
+          "a changed catalog replaces the cached one");
+    check(book.ok() && sent(4, "If-None-Match: \"b1\"\r\n") && same.ok() && same.value.author == "Ann"
+          && same.value.page_count == 10, "304 for a book answered from its cache entry");
+}
+
+static Task<vector<Status>> async_script(AsyncLibraryClient &client, vector<Book> *books) {
+    vector<Status> statuses;
+    statuses.push_back(co_await client.login("user", "pass"));
+    statuses.push_back(co_await client.enterLibrary());
+
+    Result<vector<Book>> listed = co_await client.getBooks();
+    statuses.push_back(listed.status);
+    *books = listed.value;
+
+    statuses.push_back(co_await client.deleteBook(2));
+    co_return statuses;
+}
+
+/*  The coroutine client keeps the cookie and the token it was given and
+*   sends them with the next requests, over one connection
+*/
+static void check_async_client() {
+    int server = listener(4);
+    vector<string> requests;
+    thread worker(serve, server, vector<string>({
+        reply("200 OK", "Set-Cookie: connect.sid=s1; Path=/; HttpOnly\r\n", ""),
+        reply("200 OK", "", R"({"token":"t1"})"),
+        reply("200 OK", "", R"([{"id":1,"title":"A"},{"id":2,"title":"B"}])"),
+        reply("200 OK", "", ""),
+    }), &requests);
+
+    Reactor reactor;
+    AsyncLibraryClient client(reactor, "127.0.0.1", local_port(server));
+    vector<Book> books;
+    vector<Status> statuses = reactor.block_on(async_script(client, &books));
+    check(client.loggedIn() && client.hasLibraryAccess() && client.answered() == 4, "session kept by the client");
+    worker.join();
+    close(server);
+
+    check(statuses == vector<Status>(4, Status::Ok) && same_ids(books, {1, 2}), "every operation succeeds");
+    auto sent = [&](size_t i, const string &line) {
+        return i < requests.size() && requests[i].find(line) != string::npos;
+    };
+    check(sent(0, "POST /api/v1/tema/auth/login") && sent(1, "Cookie: connect.sid=s1"), "the cookie is sent after login");
+    check(sent(2, "Authorization: Bearer t1") && sent(3, "DELETE /api/v1/tema/library/books/2")
+          && sent(3, "Authorization: Bearer t1"), "the token is sent after entering the library");
+}
+
+static Task<vector<string>> pipelined(AsyncConnection &connection, const string &request, int count) {
+    vector<string> bodies;
+    if (!co_await connection.connect())
+        co_return bodies;
+
+    string requests;
+    for (int i = 0; i < count; ++i)
+        requests += request;
+    if (!co_await connection.send(requests.data(), requests.size()))
+        co_return bodies;
+
+    for (int i = 0; i < count; ++i) {
+        Response response = co_await connection.receive();
+        bodies.emplace_back(response.http().status == 200 ? response.http().body : "failed");
+    }
+    co_return bodies;
+}
+
+/*  Requests pipelined on one connection (like the DELETEs of delete_books)
+*   get their responses in order when the server sends them all in one
+*   segment, an encoded one in the middle included
+*/
+static void check_pipelining() {
+    int server = listener(4);
+    string request = "DELETE /api/v1/tema/library/books/1 HTTP/1.1\r\nHost: x\r\n\r\n";
+    string encoded = reply("200 OK", "Content-Encoding: gzip\r\n", compressed("second", 16 + MAX_WBITS));
+    string responses = reply("200 OK", "", "first") + encoded + reply("200 OK", "", "third");
+
+    thread worker([&] {
+        int fd = accept(server, NULL, NULL);
+        string received;
+        char data[BUFLEN];
+        ssize_t bytes;
+        while (received.size() < 3 * request.size() && (bytes = read(fd, data, sizeof(data))) > 0)
+            received.append(data, bytes);
+        send(fd, responses.data(), responses.size(), MSG_NOSIGNAL);
+        close(fd);
+    });
+
+    Reactor reactor;
+    AsyncConnection connection(reactor, "127.0.0.1", local_port(server));
+    vector<string> bodies = reactor.block_on(pipelined(connection, request, 3));
+    worker.join();
+    close(server);
+
+    check(bodies == vector<string>({"first", "second", "third"}), "pipelined responses in order from one segment");
+}
+
+/*  One connection of the session server: a login gets the username as its
+*   cookie, library access the cookie as its token, and the book list one
+*   book titled with the token, so every answer depends on the session
+*/
+static void serve_session(int fd) {
+    string pending;
+    while (true) {
+        size_t end = pending.find("\r\n\r\n");
+        HttpResponse request = parse_http_response("HTTP/1.1 200 OK\r\n" + pending.substr(0, end + 4));
+        size_t length = end == string::npos ? 0 : strtoul(string(request.header("Content-Length")).c_str(), NULL, 10);
+        if (end == string::npos || pending.size() < end + 4 + length) {
+            char data[BUFLEN];
+            ssize_t bytes = read(fd, data, sizeof(data));
+            if (bytes <= 0)
+                break;
+            pending.append(data, bytes);
+            continue;
+        }
+
+        string body = pending.substr(end + 4, length);
+        string cookie(request.header("Cookie"));
+        string token(request.header("Authorization"));
+        string answer;
+        if (pending.starts_with("POST")) {
+            string username;
+            JsonObject(body).get_string("username", username);
+            answer = reply("200 OK", "Set-Cookie: connect.sid=" + username + "; Path=/\r\n", "");
+        } else if (pending.find("/library/access ") != string::npos) {
+            answer = reply("200 OK", "", R"({"token":")" + cookie.substr(cookie.find('=') + 1) + "\"}");
+        } else {
+            answer = reply("200 OK", "", R"([{"id":1,"title":")" + token.substr(token.find(' ') + 1) + "\"}]");
+        }
+        pending.erase(0, end + 4 + length);
+        send(fd, answer.data(), answer.size(), MSG_NOSIGNAL);
+    }
+    close(fd);
+}
+
+static Task<Status> session_script(Session &session) {
+    Status status = co_await session.client.login(session.username, session.password);
+    if (status == Status::Ok)
+        status = co_await session.client.enterLibrary();
+    if (status != Status::Ok)
+        co_return status;
+
+    Result<vector<Book>> books = co_await session.client.getBooks();
+    bool own = books.ok() && books.value.size() == 1 && books.value[0].title == session.username;
+    co_return books.ok() && !own ? Status::InvalidInput : books.status;
+}
+
+/*  Sessions spread over several threads each keep their own cookie and
+*   token: what the server answers one session never reaches another
+*/
+static void check_session_manager() {
+    int server = listener(64);
+    vector<thread> connections;
+    thread acceptor([&] {
+        int fd;
+        while ((fd = accept(server, NULL, NULL)) >= 0)
+            connections.emplace_back(serve_session, fd);
+    });
+
+    vector<Status> results;
+    {
+        SessionManager manager("127.0.0.1", local_port(server), 3);
+        for (int i = 0; i < 12; ++i)
+            manager.add("user" + to_string(i), "pass");
+        results = manager.run(session_script);
+    }
+
+    shutdown(server, SHUT_RDWR);
+    acceptor.join();
+    for (thread &connection : connections)
+        connection.join();
+    close(server);
+
+    check(results == vector<Status>(12, Status::Ok), "12 sessions on 3 threads each see only their own answers");
+}
+
+// Sends request over a socket pair, answered with response (whole, or
+// cut short when cut is set), and returns what receive_response gave
+static string exchange_over_pair(const string &request, const string &response, bool cut) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    thread server([&] {
+        char data[BUFLEN];
+        read(fds[1], data, sizeof(data));
+        send(fds[1], response.data(), cut ? response.size() / 2 : response.size(), MSG_NOSIGNAL);
+        close(fds[1]);
+    });
+
+    send_to_server(fds[0], (char *) request.c_str());
+    size_t size;
+    char *received = receive_response(fds[0], &size);
+    server.join();
+    close_connection(fds[0]);
+
+    string result = received != NULL ? string(received, size) : "";
+    free(received);
+    return result;
+}
+
+/*  io_uring gives the same responses as the blocking backend, and keeps
+*   bytes of a second response that arrived with the first one for the
+*   next receive on the connection
+*/
+static void check_uring_transport() {
+    if (transport_use("io_uring") < 0) {
+        cout << "# io_uring not available, its checks are skipped" << endl;
+        return;
+    }
+
+    string body = "{\"title\":\"" + string(3 * BUFLEN, 't') + "\"}";
+    string plain = reply("200 OK", "", body);
+    string encoded = reply("200 OK", "Content-Encoding: deflate\r\n", compressed(body, MAX_WBITS));
+    string get = "GET / HTTP/1.1\r\n\r\n";
+
+    check(exchange_over_pair(get, plain, false) == plain, "a response over io_uring");
+    check(parse_http_response(exchange_over_pair(get, encoded, false)).body == body, "an encoded response over io_uring");
+    check(exchange_over_pair(get, plain, true).empty(), "a response cut short over io_uring fails");
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    string second = reply("404 Not Found", "", "{}");
+    string both = plain + second;
+    send(fds[1], both.data(), both.size(), MSG_NOSIGNAL);
+
+    size_t size;
+    char *received = receive_response(fds[0], &size);
+    check(received != NULL && string(received, size) == plain, "the first of two responses sent at once");
+    free(received);
+    received = receive_response(fds[0], &size);
+    check(received != NULL && string(received, size) == second, "the second one from the bytes left over");
+    free(received);
+
+    close(fds[1]);
+    close_connection(fds[0]);
+    transport_use(NULL);
+}
+
+/*  Each exchange is read back from the log as it went over the socket
+*   (a compressed body stays compressed), in order and with its timing; a
+*   request left without a response is not logged, and a damaged log is
+*   reported as such
+*/
+static void check_traffic_log() {
+    char path[] = "/tmp/check_traffic_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0)
+        close(fd);
+
+    string body = "[" + string(200, ' ') + "]";
+    string packed = compressed(body, 16 + MAX_WBITS);
+    string plain = reply("200 OK", "", body);
+    string encoded = reply("200 OK", "Content-Encoding: gzip\r\n", packed);
+    string get = "GET /books HTTP/1.1\r\nHost: x\r\n\r\n";
+
+    check(traffic_record_start(path) == 0 && traffic_recording(), "recording starts");
+    exchange_over_pair(get, plain, false);
+    string decoded = exchange_over_pair(get, encoded, false);
+    exchange_over_pair("GET /cut HTTP/1.1\r\n\r\n", plain, true);
+    uint64_t start = traffic_clock_us();
+    traffic_record_exchange(start, "REQ", 3, "RESP", 4);
+    traffic_record_stop();
+    check(!traffic_recording() && parse_http_response(decoded).body == body, "recording stops, bodies were decoded");
+
+    traffic_reader reader;
+    traffic_exchange exchange = {{}, buffer_init(), buffer_init()};
+    vector<pair<string, string>> logged;
+    vector<traffic_record_header> headers;
+    int result = -1;
+    if (traffic_reader_open(&reader, path) == 0) {
+        while ((result = traffic_reader_next(&reader, &exchange)) == 1) {
+            logged.emplace_back(string(exchange.request.data, exchange.request.size),
+                                string(exchange.response.data, exchange.response.size));
+            headers.push_back(exchange.header);
+        }
+        traffic_reader_close(&reader);
+    }
+
+    check(result == 0 && logged.size() == 3, "every answered exchange is logged, the unanswered one is not");
+    check(logged.size() == 3 && logged[0] == make_pair(get, plain) && logged[1] == make_pair(get, encoded)
+          && logged[2] == make_pair(string("REQ"), string("RESP")), "requests and responses byte for byte");
+    check(headers.size() == 3 && headers[0].start_us <= headers[1].start_us && headers[1].start_us <= headers[2].start_us,
+          "exchanges in order of their start time");
+
+    // A record cut in its header
+    gzFile damaged = gzopen(path, "wb");
+    gzwrite(damaged, TRAFFIC_LOG_MAGIC, 8);
+    gzwrite(damaged, "\x01\x02\x03", 3);
+    gzclose(damaged);
+    result = 1;
+    if (traffic_reader_open(&reader, path) == 0) {
+        result = traffic_reader_next(&reader, &exchange);
+        traffic_reader_close(&reader);
+    }
+    check(result == -1, "a damaged log is reported");
+
+    buffer_destroy(&exchange.request);
+    buffer_destroy(&exchange.response);
+    unlink(path);
+}
+
+int main() {
+    check_breaker_transitions();
+    check_breaker_backoff();
+    check_breaker_stale();
+    check_balancer();
+    check_rate_limiter();
+    check_limiter_wakeup();
+    check_buffer_find();
+    check_http_parser();
+    check_response_ownership();
+    check_json_reader();
+    check_json_writer();
+    check_thread_pool();
+    check_catalog();
+    check_catalog_analysis();
+    check_export();
+    check_content_decoding();
+    check_watcher();
+    check_poll_schedule();
+    check_socket_options();
+    check_resolver();
+    check_connect_race();
+    check_conditional_get();
+    check_async_client();
+    check_session_manager();
+    check_pipelining();
+    check_uring_transport();
+    check_traffic_log();
+
+    cout << checks << (failed ? " checks, some FAILED" : " checks, all passed") << endl;
+    return failed ? 1 : 0;
+}
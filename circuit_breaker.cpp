@@ -0,0 +1,103 @@
+// Per-server circuit breaker
+#include <algorithm>
+#include "circuit_breaker.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+CircuitBreaker::CircuitBreaker(int failure_threshold, milliseconds open_time, int probes, milliseconds max_open_time)
+    : generation(0)
+{
+    configure(failure_threshold, open_time, probes, max_open_time);
+}
+
+void CircuitBreaker::configure(int failure_threshold, milliseconds open_time, int probes, milliseconds max_open_time)
+{
+    lock_guard<std::mutex> lock(mutex);
+    this->failure_threshold = max(failure_threshold, 1);
+    this->open_time = max(open_time, milliseconds(1));
+    this->probes = max(probes, 1);
+    this->max_open_time = max(max_open_time, this->open_time);
+    current = State::Closed;
+    failures = 0;
+    opened = 0;
+    generation++;
+}
+
+void CircuitBreaker::open(steady_clock::time_point now)
+{
+    current = State::Open;
+    generation++;
+    opened++;
+    open_until = now + min(open_time * opened, max_open_time);
+}
+
+/*  Once the open time is over the first requests become the probes, the
+*   ones after them are refused until the probes have answered
+*   The ticket is the generation of the state the request was let through
+*   in, so that only the probes count while half-open
+*/
+bool CircuitBreaker::allow(long &ticket)
+{
+    lock_guard<std::mutex> lock(mutex);
+
+    if (current == State::Open) {
+        if (steady_clock::now() < open_until)
+            return false;
+        current = State::HalfOpen;
+        generation++;
+        probes_sent = 0;
+        probes_succeeded = 0;
+    }
+
+    if (current == State::HalfOpen) {
+        if (probes_sent == probes)
+            return false;
+        probes_sent++;
+    }
+
+    ticket = generation;
+    return true;
+}
+
+void CircuitBreaker::record(long ticket, bool ok)
+{
+    lock_guard<std::mutex> lock(mutex);
+
+    // Sent before the breaker last changed state
+    if (ticket != generation)
+        return;
+
+    switch (current) {
+    case State::Closed:
+        failures = ok ? 0 : failures + 1;
+        if (failures >= failure_threshold)
+            open(steady_clock::now());
+        break;
+    case State::HalfOpen:
+        if (!ok) {
+            open(steady_clock::now());
+        } else if (++probes_succeeded == probes) {
+            current = State::Closed;
+            generation++;
+            failures = 0;
+            opened = 0;
+        }
+        break;
+    case State::Open:
+        // No request is let through while open
+        break;
+    }
+}
+
+bool CircuitBreaker::is_open(steady_clock::time_point now)
+{
+    lock_guard<std::mutex> lock(mutex);
+    return current == State::Open && now < open_until;
+}
+
+CircuitBreaker::State CircuitBreaker::state()
+{
+    lock_guard<std::mutex> lock(mutex);
+    return current;
+}
@@ -0,0 +1,58 @@
+#ifndef _CIRCUIT_BREAKER_
+#define _CIRCUIT_BREAKER_
+
+#include <chrono>
+#include <mutex>
+
+// The n-th opening in a row lasts n times open_time, up to this long
+#define DEFAULT_MAX_OPEN_TIME std::chrono::milliseconds(60000)
+
+// fails requests to a server that keeps failing without sending them:
+// closed (requests go through) until failure_threshold failures in a row,
+// then open (requests refused) for open_time, then half-open: probes
+// requests are let through and the breaker closes once they all succeeded,
+// or opens again (for longer each time, up to max_open_time) if one fails
+class CircuitBreaker {
+public:
+    enum class State { Closed, Open, HalfOpen };
+
+    CircuitBreaker(int failure_threshold = 5, std::chrono::milliseconds open_time = std::chrono::milliseconds(5000),
+                   int probes = 1, std::chrono::milliseconds max_open_time = DEFAULT_MAX_OPEN_TIME);
+
+    // changes the thresholds and closes the breaker
+    void configure(int failure_threshold, std::chrono::milliseconds open_time, int probes,
+                   std::chrono::milliseconds max_open_time = DEFAULT_MAX_OPEN_TIME);
+
+    // returns false if a request must fail right away; every allowed
+    // request is then reported to record() with the ticket set here
+    bool allow(long &ticket);
+
+    // outcome of an allowed request; the outcome of a request let through
+    // before the last change of state is stale and ignored (e.g. one sent
+    // while closed does not count as a probe)
+    void record(long ticket, bool ok);
+
+    // true while requests are refused
+    bool is_open(std::chrono::steady_clock::time_point now);
+
+    State state();
+
+private:
+    void open(std::chrono::steady_clock::time_point now);
+
+    std::mutex mutex;
+    int failure_threshold;
+    std::chrono::milliseconds open_time;
+    int probes;
+    std::chrono::milliseconds max_open_time;
+
+    State current;
+    int failures;                       // in a row, while closed
+    int opened;                         // times opened since the last close
+    int probes_sent;                    // while half-open
+    int probes_succeeded;
+    std::chrono::steady_clock::time_point open_until;
+    long generation;                    // changes with every state change
+};
+
+#endif
@@ -1,396 +1,604 @@
 // Client side of a virtual library application
+#include <errno.h>
+#include <string.h>
+#include <fstream>
 #include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
 #include <string>
-#include <arpa/inet.h>
-#include "nlohmann/json.hpp"
+#include <thread>
+#include "book_watcher.hpp"
+#include "catalog.hpp"
+#include "catalog_analysis.hpp"
+#include "catalog_export.hpp"
+#include "library_client.hpp"
+#include "session_manager.hpp"
+#include "thread_pool.hpp"
 
 extern "C" {
-  #include "helpers.h"
+  #include "content_decoding.h"
+  #include "traffic_log.h"
+  #include "transport.h"
+  #include "resolver.h"
 }
 
-using json = nlohmann::json;
-
 using namespace std;
 
 #define SERVER_IP "34.254.242.81"
 #define SERVER_PORT 8080
 
-/* Check if string is a valid input:
-*  allowed characters: alphanumeric, underscore, dot, dash
+// Number of authors listed by analyze
+#define TOP_AUTHORS 10
+
+// Connections delete_books keeps open at once
+#define DELETE_CONNECTIONS 8
+
+// Command line options
+struct Options {
+    double rate = 0;
+    double burst = 1;
+    int max_concurrency = 64;
+    int threads = max((int) thread::hardware_concurrency(), 1);
+    int workers = 8;
+    vector<pair<string, int>> servers;     // the compiled-in server if empty
+    int dns_ttl = -1;
+    int breaker_failures = 5;
+    int breaker_open_ms = 5000;
+    int breaker_probes = 1;
+    string transport = "blocking";
+    socket_options sockets = {};
+    bool compression = true;
+    string record;                          // traffic log to write, none if empty
+};
+
+void configure_limiter(RateLimiter &limiter, const Options &options);
+
+/*  Parse a book id typed by the user
+*   Returns -1 if the id is not a valid number
+*/
+int parse_id(const string &id) {
+    if (id.empty() || id.length() > 9 || !is_number_valid(id))
+        return -1;
+    return atoi(id.c_str());
+}
+
+/*  Parse a list of book ids such as 1,4,10-20
+*   Returns false if any part of it is not a valid id or range
 */
-bool is_string_valid(string s) {
-    for (unsigned long i = 0; i < s.length(); ++i) {
-        if (!isalnum(s[i]) && s[i] != '_' && s[i] != '.' && s[i] != '-') {
+bool parse_id_list(const string &list, vector<int> &ids) {
+    stringstream parts(list);
+    string part;
+
+    while (getline(parts, part, ',')) {
+        size_t dash = part.find('-');
+        int first = parse_id(part.substr(0, dash));
+        int last = dash == string::npos ? first : parse_id(part.substr(dash + 1));
+
+        if (first < 0 || last < first)
             return false;
-        }
+        for (int id = first; id <= last; ++id)
+            ids.push_back(id);
     }
-    return true;
+    return !ids.empty();
 }
 
-/*  Check if string is a valid number:
-*   allowed characters: digits
+/*  Print how busy every worker of the pool was during a bulk command
 */
-bool is_number_valid(string s) {
-    for (unsigned long i = 0; i < s.length(); ++i) {
-        if (!isdigit(s[i])) {
-            return false;
-        }
+void print_utilization(ThreadPool &pool) {
+    vector<ThreadPool::WorkerStats> stats = pool.stats();
+
+    for (size_t i = 0; i < stats.size(); ++i) {
+        cout << "worker " << i << ": " << stats[i].executed << " tasks (" << stats[i].stolen << " stolen), "
+             << fixed << setprecision(1) << stats[i].utilization * 100 << "% busy" << endl;
     }
-    return true;
+    cout.unsetf(ios::floatfield);
 }
 
-/*  Post request to register a new user
-*   Returns void, prints the response from the server
+/*  Prompt for username and password
 */
-void register_user() {
-    // Prompt for username and password
-    string username, password;
+void read_credentials(string &username, string &password) {
     cout << "username=";
     cin >> username;
     cout << "password=";
     cin >> password;
+}
 
-    if (!is_string_valid(username) || !is_string_valid(password)) {
-        cout << "Error: Invalid username or password!" << endl;
-        return;
-    }
-    
-    int sockfd = open_connection(SERVER_IP, SERVER_PORT, AF_INET, SOCK_STREAM, 0);
-
-    // Create the json object
-    json user;
-    user["username"] = username;
-    user["password"] = password;
-
-    // Json to string
-    string reg = user.dump();
-
-    char *message = compute_post_request(SERVER_IP, "/api/v1/tema/auth/register", "application/json", reg.c_str(), reg.length(), NULL, 0, NULL);
-    send_to_server(sockfd, message);
-    free(message);
-    
-    message = receive_from_server(sockfd);
-    string response = string(message);
-    free(message);
+/*  Register a new user
+*   Returns void, prints the response from the server
+*/
+void register_user(LibraryClient &client) {
+    string username, password;
+    read_credentials(username, password);
 
-    // Interpret response
-    if (response.find("error") != string::npos) {
-        cout << "Error: The username is taken!" << endl;
-    } else {
+    switch (client.registerUser(username, password)) {
+    case Status::Ok:
         cout << "User " << username << " registered!" << endl;
+        break;
+    case Status::InvalidInput:
+        cout << "Error: Invalid username or password!" << endl;
+        break;
+    case Status::NoResponse:
+        cout << "Server did not respond, try again!" << endl;
+        break;
+    default:
+        cout << "Error: The username is taken!" << endl;
     }
 }
 
-//  Extract cookie from string
-string extract_cookie(string response) {
-    int start = response.find("connect.sid");
-    int end = response.find(";", start);
-    return response.substr(start, end - start);
-}
-
-/*  Post request to login an existing user
-*   Returns cookie, prints the response from the server
+/*  Login an existing user
+*   Returns void, prints the response from the server
 */
-string login() {
-    // Prompt for username and password
+void login(LibraryClient &client) {
     string username, password;
-    cout << "username=";
-    cin >> username;
-    cout << "password=";
-    cin >> password;
+    read_credentials(username, password);
 
-    if (!is_string_valid(username) || !is_string_valid(password)) {
+    switch (client.login(username, password)) {
+    case Status::Ok:
+        cout << "User " << username << " loged in!" << endl;
+        break;
+    case Status::InvalidInput:
         cout << "Error: Invalid username or password!" << endl;
-        return string("-1");
-    }
-
-    int sockfd = open_connection(SERVER_IP, SERVER_PORT, AF_INET, SOCK_STREAM, 0);
-
-    // Create the json object
-    json user;
-    user["username"] = username;
-    user["password"] = password;
-
-    // Json to string
-    string log = user.dump();
-
-    char *message = compute_post_request(SERVER_IP, "/api/v1/tema/auth/login", "application/json", log.c_str(), log.length(), NULL, 0, NULL);
-    send_to_server(sockfd, message);
-    free(message);
-    
-    message = receive_from_server(sockfd);
-    close_connection(sockfd);
-
-    string response = string(message);
-    free(message);
-
-    // Interpret response
-    if (response.find("error") != string::npos) {
+        break;
+    case Status::NoResponse:
+        cout << "Server did not respond, try again!" << endl;
+        break;
+    default:
         cout << "Error: Invalid Username or Password" << endl;
-        return string("-1");
-    } else {
-        if (response.find("connect.sid") == string::npos) {
-            cout << "Server did not respond, try again!" << endl;
-            return string("-1");
-        }
-
-        cout << "User " << username << " loged in!" << endl;
-
-        // Extract cookie
-        return extract_cookie(response);
     }
-
 }
 
-/*  Extract JWT token from string
+/* Request library access
+*  Returns void, prints the response from the server
 */
-string extract_token(string response) {
-    int start = response.find("{\"token\"");
-    json j = json::parse(response.substr(start));
-    return j["token"];
+void enter_library(LibraryClient &client) {
+    switch (client.enterLibrary()) {
+    case Status::Ok:
+        cout << "Library access granted!" << endl;
+        break;
+    case Status::NoResponse:
+        cout << "Server did not respond, try again!" << endl;
+        break;
+    default:
+        cout << "Error: Invalid session" << endl;
+    }
 }
 
-/* Get request for library access
-* Has as parameter the session cookie
-* Prints the response from server and returns a JWT token if access is granted
+/* Print all books
 */
-string enter_library(string cookie) {
-    int sockfd = open_connection(SERVER_IP, SERVER_PORT, AF_INET, SOCK_STREAM, 0);
-
-    const char *cookies[1] = {cookie.c_str()}; 
-    char *message = compute_get_request(SERVER_IP, "/api/v1/tema/library/access", NULL, cookies, 1, NULL);
-    send_to_server(sockfd, message);
-    free(message);
-
-    message = receive_from_server(sockfd);
-    string response = string(message);
-    free(message);
-
-    close_connection(sockfd);
-
-    // Interpret response
-    if (response.find("error") != string::npos) {
-        cout << "Error: Invalid session" << endl;
-        return string("-1");
-    } else {
-        if (response.find("token") == string::npos) {
-            cout << "Server did not respond, try again!" << endl;
-            return string("-1");
-        }
-        cout << "Library access granted!" << endl;
-        
-        // Extract JWT token
-        return extract_token(response);
+void print_books(const vector<Book> &books) {
+    for (const Book &book : books) {
+        cout << "id=" << book.id;
+        cout << "\ttitle=" << quoted(book.title) << endl;
     }
 }
 
-/* Print all books in response
+/*  Get all books in the library
+*   Returns void, prints the response from the server
 */
-void print_books(string response) {
-    int start = response.find("[");
-    int end = response.find("]");
-    json j = json::parse(response.substr(start, end - start + 1));
-    for (auto it = j.begin(); it != j.end(); ++it) {
-        cout << "id=" << it.value()["id"];
-        cout << "\ttitle=" << it.value()["title"] << endl;
+void get_books(LibraryClient &client) {
+    Result<vector<Book>> books = client.getBooks();
+
+    switch (books.status) {
+    case Status::Ok:
+        print_books(books.value);
+        break;
+    case Status::NoResponse:
+        cout << "Server did not respond, try again!" << endl;
+        break;
+    default:
+        cout << "Error: You don't have acces to the library!" << endl;
     }
 }
 
-/*  Get request for all books in the library
-*   Has as parameter the JWT token
+/*  Print book
+*/
+void print_book(const Book &book) {
+    cout << "title=" << quoted(book.title) << endl;
+    cout << "author=" << quoted(book.author) << endl;
+    cout << "genre=" << quoted(book.genre) << endl;
+    cout << "page count=" << book.page_count << endl;
+    cout << "publisher=" << quoted(book.publisher) << endl;
+}
+
+/*  Get a book with a given id
 *   Returns void, prints the response from the server
 */
-void get_books(string token) {
-    int sockfd = open_connection(SERVER_IP, SERVER_PORT, AF_INET, SOCK_STREAM, 0);
+void get_book(LibraryClient &client, string id) {
+    int book_id = parse_id(id);
+    if (book_id < 0) {
+        cout << "Error: Invalid book id!" << endl;
+        return;
+    }
 
-    char *message = compute_get_request(SERVER_IP, "/api/v1/tema/library/books", NULL, NULL, 0, token.c_str());
-    send_to_server(sockfd, message);
-    free(message);
+    Result<Book> book = client.getBook(book_id);
 
-    message = receive_from_server(sockfd);
-    string response = string(message);
-    free(message);
+    switch (book.status) {
+    case Status::Ok:
+        print_book(book.value);
+        break;
+    case Status::NotFound:
+        cout << "Error: Book does not exist!" << endl;
+        break;
+    case Status::NoResponse:
+        cout << "Server did not respond, try again!" << endl;
+        break;
+    default:
+        cout << "Error: You don't have acces to the library!" << endl;
+    }
+}
 
-    close_connection(sockfd);
+/*  Add a book to the library
+*   Has as parameter the book details: title, author, genre, page_count, publisher
+*   Returns void, prints the response from the server
+*/
+void add_book(LibraryClient &client, string title, string author, string genre, string page_count, string publisher) {
+    Book book = {0, title, author, genre, publisher, parse_id(page_count)};
 
-    // Interpret response
-    if (response.find("error") != string::npos) {
+    switch (client.addBook(book)) {
+    case Status::Ok:
+        cout << "Book added!" << endl;
+        break;
+    case Status::InvalidInput:
+        cout << "Error: Invalid book details!" << endl;
+        break;
+    case Status::NoResponse:
+        cout << "Server did not respond, try again!" << endl;
+        break;
+    default:
         cout << "Error: You don't have acces to the library!" << endl;
-    } else {
-        if (response.find("200 OK") == string::npos) {
-            cout << "Server did not respond, try again!" << endl;
-            return;
-        } 
-        print_books(response);
     }
 }
 
-/*  Print book
+/* Delete a book from the library
+*   Returns void, prints the response from the server
 */
-void print_book(string response) {
-    int start = response.find("{");
-    int end = response.find("}");
-    json j = json::parse(response.substr(start, end - start + 1));
-    cout << "title=" << j["title"] << endl;
-    cout << "author=" << j["author"] << endl;
-    cout << "genre=" << j["genre"] << endl;
-    cout << "page count=" << j["page_count"] << endl;
-    cout << "publisher=" << j["publisher"] << endl;
+void delete_book(LibraryClient &client, string id) {
+    int book_id = parse_id(id);
+    if (book_id < 0) {
+        cout << "Error: Invalid book id!" << endl;
+        return;
+    }
 
+    switch (client.deleteBook(book_id)) {
+    case Status::Ok:
+        cout << "Book deleted!" << endl;
+        break;
+    case Status::NotFound:
+        cout << "Error: Book not found!" << endl;
+        break;
+    case Status::NoResponse:
+        cout << "Server did not respond, try again!" << endl;
+        break;
+    default:
+        cout << "Error: You don't have acces to the library!" << endl;
+    }
 }
 
-/*  Get request for a book with a given id
-*   Has as parameter the JWT token and a book id
+/*  Logout
 *   Returns void, prints the response from the server
 */
-void get_book(string token, string id) {
+void logout(LibraryClient &client) {
+    switch (client.logout()) {
+    case Status::Ok:
+        cout << "Logged out!" << endl;
+        break;
+    case Status::NoResponse:
+        cout << "Server did not respond, try again!" << endl;
+        break;
+    default:
+        cout << "You are not authenticated" << endl;
+    }
+}
 
-    if (!is_number_valid(id)) {
-        cout << "Error: Invalid book id!" << endl;
+/*  Get many books at once, spreading the requests over the thread pool
+*   Has as parameter a list of book ids (e.g. 1,4,10-20)
+*   Returns void, prints the books in the order of the list
+*/
+void bulk_get_book(LibraryClient &client, ThreadPool &pool, string list) {
+    vector<int> ids;
+    if (!parse_id_list(list, ids)) {
+        cout << "Error: Invalid book id list!" << endl;
         return;
     }
 
-    int sockfd = open_connection(SERVER_IP, SERVER_PORT, AF_INET, SOCK_STREAM, 0);
+    vector<Result<Book>> books(ids.size());
+    pool.reset_stats();
+    pool.parallel_for(ids.size(), [&](int i) { books[i] = client.getBook(ids[i]); });
+
+    for (size_t i = 0; i < ids.size(); ++i) {
+        cout << "id=" << ids[i] << endl;
+        if (books[i].ok())
+            print_book(books[i].value);
+        else if (books[i].status == Status::NotFound)
+            cout << "Error: Book does not exist!" << endl;
+        else if (books[i].status == Status::NoResponse)
+            cout << "Server did not respond, try again!" << endl;
+        else
+            cout << "Error: You don't have acces to the library!" << endl;
+    }
+    print_utilization(pool);
+}
 
-    string aux = string("/api/v1/tema/library/books/") + id;
-    char *message = compute_get_request(SERVER_IP, aux.c_str(), NULL, NULL, 0, token.c_str());
-    send_to_server(sockfd, message);
-    free(message);
+/*  Add every book of a file to the library, in parallel
+*   Each line holds: title author genre page_count publisher
+*   Returns void, prints how many books were added
+*/
+void import_books(LibraryClient &client, ThreadPool &pool, string path) {
+    ifstream file(path);
+    if (!file) {
+        cout << "Error: Cannot open " << path << "!" << endl;
+        return;
+    }
 
-    message = receive_from_server(sockfd);
-    string response = string(message);
-    free(message);
+    vector<Book> books;
+    string line, page_count;
+    while (getline(file, line)) {
+        Book book = {};
+        stringstream fields(line);
+        if (fields >> book.title >> book.author >> book.genre >> page_count >> book.publisher) {
+            book.page_count = parse_id(page_count);
+            books.push_back(book);
+        }
+    }
 
-    close_connection(sockfd);   
+    vector<Status> results(books.size());
+    pool.reset_stats();
+    pool.parallel_for(books.size(), [&](int i) { results[i] = client.addBook(books[i]); });
+
+    int added = count(results.begin(), results.end(), Status::Ok);
+    int invalid = count(results.begin(), results.end(), Status::InvalidInput);
+    int unanswered = count(results.begin(), results.end(), Status::NoResponse);
+    cout << added << "/" << books.size() << " books added";
+    if (invalid > 0)
+        cout << ", " << invalid << " with invalid details";
+    if (unanswered > 0)
+        cout << ", " << unanswered << " without a response from the server";
+    cout << endl;
+    print_utilization(pool);
+}
 
-    // Interpret response
-    if (response.find("\"error\":\"No book was found!\"") != string::npos) {
-        cout << "Error: Book does not exist!" << endl;
-    } else if (response.find("error") != string::npos) {
-        cout << "Error: You don't have acces to the library!" << endl;
-    } else {
-        if (response.find("200 OK") == string::npos) {
-            cout << "Server did not respond, try again!" << endl;
-            return;
-        } 
-        print_book(response);
+/*  One of the connections of delete_books: deletes ids, taking the next one
+*   from the shared list, until none is left
+*/
+Task<void> delete_worker(AsyncLibraryClient &client, const vector<int> &ids, size_t &next, vector<Status> &results) {
+    while (next < ids.size()) {
+        size_t i = next++;
+        results[i] = co_await client.deleteBook(ids[i]);
     }
 }
 
-/*  Post request to add a book to the library
-*   Has as parameter the JWT token and book details: title, author, genre, page_count, publisher
-*   Returns void, prints the response from the server
+/*  Delete many books at once over a few persistent connections, all driven
+*   by one event loop, with the session of the client
+*   Has as parameter a list of book ids (e.g. 1,4,10-20) or "all"
+*   Returns void, prints how many books were deleted
 */
-void add_book(string token, string title, string author, string genre, string page_count, string publisher) {
-
-    if (!is_string_valid(title) || !is_string_valid(author) || !is_string_valid(genre) 
-        || !is_string_valid(publisher) || !is_number_valid(page_count)) {
-        cout << "Error: Invalid book details!" << endl;
+void delete_books(LibraryClient &client, LoadBalancer &balancer, string list) {
+    vector<int> ids;
+    if (list == "all") {
+        Result<vector<Book>> books = client.getBooks();
+        if (!books.ok()) {
+            if (books.status == Status::NoResponse)
+                cout << "Server did not respond, try again!" << endl;
+            else
+                cout << "Error: You don't have acces to the library!" << endl;
+            return;
+        }
+        for (const Book &book : books.value)
+            ids.push_back(book.id);
+    } else if (!parse_id_list(list, ids)) {
+        cout << "Error: Invalid book id list!" << endl;
         return;
     }
 
-    // Create the json object
-    json book;
-    book["title"] = title;
-    book["author"] = author;
-    book["genre"] = genre;
-    book["page_count"] = page_count;
-    book["publisher"] = publisher;
+    Reactor reactor;
+    vector<unique_ptr<AsyncLibraryClient>> connections;
+    vector<Status> results(ids.size(), Status::NoResponse);
+    size_t next = 0;
 
-    // Json to string
-    string add = book.dump();
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < min((size_t) DELETE_CONNECTIONS, ids.size()); ++i) {
+        connections.push_back(make_unique<AsyncLibraryClient>(reactor, balancer, &client.limiter()));
+        connections.back()->useSession(client.sessionCookie(), client.accessToken());
+        reactor.spawn(delete_worker(*connections.back(), ids, next, results));
+    }
+    reactor.run();
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int deleted = count(results.begin(), results.end(), Status::Ok);
+    int not_found = count(results.begin(), results.end(), Status::NotFound);
+    int unanswered = count(results.begin(), results.end(), Status::NoResponse);
+    cout << deleted << " deleted, " << not_found << " not found, " << unanswered << " without response, "
+         << ids.size() - deleted - not_found - unanswered << " failed in " << fixed << setprecision(3)
+         << elapsed << "s" << endl;
+    cout.unsetf(ios::floatfield);
+}
 
-    int sockfd = open_connection(SERVER_IP, SERVER_PORT, AF_INET, SOCK_STREAM, 0);
+/*  Fetch the details of every book of the library into the local catalog,
+*   spreading the requests over the thread pool
+*   Returns void, prints how many books the catalog holds
+*/
+void fetch_catalog(LibraryClient &client, ThreadPool &pool, Catalog &catalog) {
+    Result<vector<Book>> list = client.getBooks();
+    if (!list.ok()) {
+        if (list.status == Status::NoResponse)
+            cout << "Server did not respond, try again!" << endl;
+        else
+            cout << "Error: You don't have acces to the library!" << endl;
+        return;
+    }
 
-    char *message = compute_post_request(SERVER_IP, "/api/v1/tema/library/books", "application/json", 
-                                        add.c_str(), add.length(), NULL, 0, token.c_str());
+    vector<Result<Book>> books(list.value.size());
+    pool.reset_stats();
+    pool.parallel_for(books.size(), [&](int i) { books[i] = client.getBook(list.value[i].id); });
 
-    send_to_server(sockfd, message);
-    free(message);
-    
-    message = receive_from_server(sockfd);
-    string response = string(message);
-    free(message);
+    catalog.clear();
+    catalog.reserve(books.size());
+    for (const Result<Book> &book : books) {
+        if (book.ok())
+            catalog.add(book.value);
+    }
 
-    close_connection(sockfd);
+    cout << catalog.size() << "/" << books.size() << " books fetched into the catalog" << endl;
+    print_utilization(pool);
+}
 
-    // Interpret response
-    if (response.find("error") != string::npos) {
-        cout << "Error: You don't have acces to the library!" << endl;
-    } else {
-        if (response.find("200 OK") == string::npos) {
-            cout << "Server did not respond, try again!" << endl;
-            return;
-        } 
-        cout << "Book added!" << endl;
+/*  Print the groups of a dictionary column, largest first
+*/
+void print_groups(const string &title, const StringPool &names, const GroupStats &stats, size_t limit) {
+    cout << title << ":" << endl;
+    for (uint32_t code : top_groups(stats, limit)) {
+        cout << "  " << quoted(string(names[code])) << ": " << stats.counts[code] << " books, "
+             << stats.page_sums[code] << " pages (" << fixed << setprecision(1)
+             << (double) stats.page_sums[code] / stats.counts[code] << " on average)" << endl;
+        cout.unsetf(ios::floatfield);
     }
 }
 
-/* Delete request to delete a book from the library
-*   Has as parameter the JWT token and a book id
-*   Returns void, prints the response from the server
+/*  Compute statistics over the local catalog: page counts, books per genre and
+*   per publisher and the authors with the most books
+*   Returns void, prints the statistics and how long they took
 */
-void delete_book(string token, string id) {
-    if (!is_number_valid(id)) {
-        cout << "Error: Invalid book id!" << endl;
+void analyze(const Catalog &catalog) {
+    if (catalog.size() == 0) {
+        cout << "Error: The catalog is empty, run fetch_catalog first!" << endl;
         return;
     }
 
-    int sockfd = open_connection(SERVER_IP, SERVER_PORT, AF_INET, SOCK_STREAM, 0);
+    auto start = chrono::steady_clock::now();
+    ColumnStats pages = column_stats(catalog.page_counts());
+    GroupStats genres = group_by(catalog.genres(), catalog.page_counts(), catalog.genre_names().size());
+    GroupStats publishers = group_by(catalog.publishers(), catalog.page_counts(), catalog.publisher_names().size());
+    GroupStats authors = group_by(catalog.authors(), catalog.page_counts(), catalog.author_names().size());
+    double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 
-    string aux = string("/api/v1/tema/library/books/") + id;
-    char *message = compute_delete_request(SERVER_IP, aux.c_str(), NULL, NULL, 0, token.c_str());
-    send_to_server(sockfd, message);
-    free(message);
+    cout << pages.count << " books, " << pages.sum << " pages (" << fixed << setprecision(1) << pages.average()
+         << " on average, " << pages.min << " to " << pages.max << ")" << endl;
+    cout.unsetf(ios::floatfield);
 
-    message = receive_from_server(sockfd);
-    string response = string(message);
-    free(message);
+    print_groups("Books per genre", catalog.genre_names(), genres, genres.counts.size());
+    print_groups("Books per publisher", catalog.publisher_names(), publishers, publishers.counts.size());
+    print_groups("Top authors", catalog.author_names(), authors, TOP_AUTHORS);
 
-    close_connection(sockfd);
+    cout << "Analyzed in " << fixed << setprecision(3) << elapsed << " ms (" << column_stats_impl() << ")" << endl;
+    cout.unsetf(ios::floatfield);
+}
 
-    // Interpret response
-    if (response.find("error") != string::npos) {
-        cout << "Error: You don't have acces to the library!" << endl;
-    } else if (response.find("404 Not Found") != string::npos) {
-        cout << "Error: Book not found!" << endl;
-    } else {
-        if (response.find("200 OK") == string::npos) {
-            cout << "Server did not respond, try again!" << endl;
-            return;
-        } 
-        cout << "Book deleted!" << endl;
+/*  Write the local catalog to a file
+*   Has as parameter the format (csv, jsonl or columnar) and the path of the file
+*   Returns void, prints how much was written
+*/
+void export_books(const Catalog &catalog, string format_name, string path) {
+    ExportFormat format;
+    if (!parse_export_format(format_name, format)) {
+        cout << "Error: Unknown format " << format_name << "!" << endl;
+        return;
     }
+    if (catalog.size() == 0) {
+        cout << "Error: The catalog is empty, run fetch_catalog first!" << endl;
+        return;
+    }
+
+    size_t bytes;
+    auto start = chrono::steady_clock::now();
+    if (!export_catalog(catalog, path, format, bytes)) {
+        cout << "Error: Cannot write " << path << ": " << strerror(errno) << endl;
+        return;
+    }
+    double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+    cout << catalog.size() << " books exported to " << path << " (" << bytes << " bytes in " << fixed
+         << setprecision(1) << elapsed << " ms)" << endl;
+    cout.unsetf(ios::floatfield);
 }
 
-/*  Get request to logout
-*   Has as parameter the JWT token
-*   Returns void, prints the response from the server
+/*  Script run by every load test session:
+*   register (the user may already exist), login, enter_library, get_books, logout
+*/
+Task<Status> load_test_session(Session &session) {
+    Status status = co_await session.client.registerUser(session.username, session.password);
+    if (status != Status::Ok && status != Status::UsernameTaken)
+        co_return status;
+
+    if ((status = co_await session.client.login(session.username, session.password)) != Status::Ok)
+        co_return status;
+    if ((status = co_await session.client.enterLibrary()) != Status::Ok)
+        co_return status;
+    if ((status = (co_await session.client.getBooks()).status) != Status::Ok)
+        co_return status;
+
+    co_return co_await session.client.logout();
+}
+
+/*  Run many logged-in users at once from this process
+*   Has as parameter the number of sessions and a prefix for their usernames
+*   Returns void, prints how many sessions succeeded and the request rate
 */
-void logout(string cookie) {
-    int sockfd = open_connection(SERVER_IP, SERVER_PORT, AF_INET, SOCK_STREAM, 0);
+void load_test(LoadBalancer &balancer, string count, string prefix, const Options &options) {
+    int sessions = parse_id(count);
+    if (sessions <= 0 || !is_string_valid(prefix)) {
+        cout << "Error: Invalid load test parameters!" << endl;
+        return;
+    }
 
-    const char *cookies[1] = {cookie.c_str()};
-    char *message = compute_get_request(SERVER_IP, "/api/v1/tema/auth/logout", NULL, cookies, 1, NULL);
-    send_to_server(sockfd, message);
+    SessionManager manager(balancer, options.threads);
+    configure_limiter(manager.limiter(), options);
+    for (int i = 0; i < sessions; ++i)
+        manager.add(prefix + to_string(i), prefix + to_string(i));
 
-    free(message);
+    auto start = chrono::steady_clock::now();
+    vector<Status> results = manager.run(load_test_session);
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    message = receive_from_server(sockfd);
-    string response = string(message);
-    free(message);
+    int succeeded = count_if(results.begin(), results.end(), [](Status s) { return s == Status::Ok; });
+    long answered = 0;
+    for (int i = 0; i < manager.size(); ++i)
+        answered += manager[i].client.answered();
 
-    close_connection(sockfd);
+    cout << succeeded << "/" << sessions << " sessions succeeded in " << fixed << setprecision(3)
+         << elapsed << "s (" << setprecision(1) << answered / elapsed << " requests/s)" << endl;
+    cout.unsetf(ios::floatfield);
+}
 
-    // Interpret response
-    if (response.find("error") != string::npos) {
-        cout << "You are not authenticated" << endl;
-    } else {
-        if (response.find("200 OK") == string::npos) {
-            cout << "Server did not respond, try again!" << endl;
+/*  Poll the list of books and print only the books added (+) and removed (-)
+*   Has as parameters the interval in seconds and the number of polls (0 polls until the program is stopped)
+*   The polls reuse one pooled connection and are conditional, so an unchanged list costs a 304;
+*   while nothing changes (or the server does not respond) the interval doubles, up to 8 times, with jitter
+*/
+void watch(LibraryClient &client, string interval, string polls) {
+    double seconds = atof(interval.c_str());
+    int count = polls == "0" ? 0 : parse_id(polls);
+    if (seconds <= 0 || count < 0) {
+        cout << "Error: Invalid watch parameters!" << endl;
+        return;
+    }
+
+    BookWatcher watcher;
+    PollSchedule schedule(chrono::milliseconds((long) (seconds * 1000)));
+
+    for (int poll = 0; count == 0 || poll < count; ++poll) {
+        Result<vector<Book>> books = client.getBooks();
+        bool changed = false;
+
+        if (books.ok()) {
+            BookChanges changes = watcher.update(books.value);
+            if (poll == 0)
+                cout << "Watching " << watcher.size() << " books" << endl;
+            for (const Book &book : changes.added)
+                cout << "+ id=" << book.id << "\ttitle=" << quoted(book.title) << endl;
+            for (const Book &book : changes.removed)
+                cout << "- id=" << book.id << "\ttitle=" << quoted(book.title) << endl;
+            changed = poll == 0 || !changes.empty();
+        } else if (books.status == Status::NoResponse) {
+            cout << "Server did not respond, retrying later" << endl;
+        } else {
+            cout << "Error: You don't have acces to the library!" << endl;
             return;
-        } 
-        cout << "Logged out!" << endl;
+        }
+
+        chrono::milliseconds delay = schedule.next(changed);
+        if (count == 0 || poll + 1 < count)
+            this_thread::sleep_for(delay);
     }
 }
 
@@ -401,39 +609,38 @@ void exit_app() {
 }
 
 /*  Function that parses input from stdin
-*   Allowed commands: register, login, enter_library, get_books, get_book, add_book, delete_book, logout, exit
+*   Allowed commands: register, login, enter_library, get_books, get_book, add_book, delete_book, logout,
+*   bulk_get_book, delete_books, import, fetch_catalog, analyze, export, load_test, watch, exit
 *   Returns void , calls the function and prints the response from the server
 */
-void parse_stdin()
+void parse_stdin(LibraryClient &client, LoadBalancer &balancer, ThreadPool &pool, Catalog &catalog, const Options &options)
 {
-    string cookie = "-1";
-    string token = "-1";
-
     while (true) {
         string command;
-        cin >> command;
+        if (!(cin >> command))
+            exit_app();
 
         if (command == "register") {
-            if(cookie != "-1") {
+            if (client.loggedIn()) {
                 cout << "Error: You are already logged in!" << endl;
                 continue;
-            }           
-            register_user();
+            }
+            register_user(client);
         } else if (command == "login") {
-            if(cookie != "-1") {
+            if (client.loggedIn()) {
                 cout << "Error: You are already logged in!" << endl;
                 continue;
             }
-            cookie = login();
+            login(client);
         } else if (command == "enter_library") {
-            token = enter_library(cookie);
+            enter_library(client);
         } else if (command == "get_books") {
-            get_books(token);
+            get_books(client);
         } else if (command == "get_book") {
             string id;
             cout << "Book id: ";
             cin >> id;
-            get_book(token, id);
+            get_book(client, id);
         } else if (command == "add_book") {
             string title, author, genre, publisher, page_count;
             cout << "Book title: ";
@@ -446,21 +653,58 @@ void parse_stdin()
             cin >> page_count;
             cout << "Book publisher: ";
             cin >> publisher;
-            add_book(token, title, author, genre, page_count, publisher);
+            add_book(client, title, author, genre, page_count, publisher);
         } else if (command == "delete_book") {
             string id;
             cout << "Book id: ";
             cin >> id;
-            delete_book(token, id);
+            delete_book(client, id);
         } else if (command == "logout") {
-            if (cookie == "-1") {
+            if (!client.loggedIn()) {
                 cout << "Error: You are not logged in!" << endl;
                 continue;
             }
-            
-            logout(cookie);
-            cookie = "-1";
-            token = "-1";
+            logout(client);
+        } else if (command == "bulk_get_book") {
+            string ids;
+            cout << "Book ids: ";
+            cin >> ids;
+            bulk_get_book(client, pool, ids);
+        } else if (command == "delete_books") {
+            string ids;
+            cout << "Book ids: ";
+            cin >> ids;
+            delete_books(client, balancer, ids);
+        } else if (command == "import") {
+            string path;
+            cout << "File: ";
+            cin >> path;
+            import_books(client, pool, path);
+        } else if (command == "fetch_catalog") {
+            fetch_catalog(client, pool, catalog);
+        } else if (command == "analyze") {
+            analyze(catalog);
+        } else if (command == "export") {
+            string format, path;
+            cout << "Format: ";
+            cin >> format;
+            cout << "File: ";
+            cin >> path;
+            export_books(catalog, format, path);
+        } else if (command == "load_test") {
+            string count, prefix;
+            cout << "Sessions: ";
+            cin >> count;
+            cout << "Username prefix: ";
+            cin >> prefix;
+            load_test(balancer, count, prefix, options);
+        } else if (command == "watch") {
+            string interval, polls;
+            cout << "Interval (seconds): ";
+            cin >> interval;
+            cout << "Polls: ";
+            cin >> polls;
+            watch(client, interval, polls);
         } else if (command == "exit") {
             exit_app();
         } else {
@@ -469,11 +713,115 @@ void parse_stdin()
     }
 }
 
+/*  Parse command line options:
+*   --server=<host>[:<port>],... (names, IPv4 addresses or [IPv6 addresses] of the replicas)
+*   --dns-ttl=<seconds to keep resolved names>
+*   --breaker-failures=<failures in a row>  --breaker-open=<ms>  --breaker-probes=<requests>
+*   --rate=<requests per second>  --burst=<requests>  --max-concurrency=<requests>
+*   --threads=<event loop threads for load tests>  --workers=<threads for bulk commands>
+*   --transport=<blocking or io_uring>
+*   --nodelay  --quickack  --fastopen  --rcvbuf=<bytes>  --sndbuf=<bytes>
+*   --compression=<0 to stop asking for gzip/deflate bodies>
+*   --record=<traffic log to write, for the replay server>
+*/
+void parse_args(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        size_t eq = arg.find('=');
+        string name = arg.substr(0, eq);
+        string value = eq == string::npos ? "" : arg.substr(eq + 1);
+
+        if (name == "--server") {
+            // Replicas are separated by commas
+            stringstream list(value);
+            string server;
+            while (getline(list, server, ',')) {
+                char host[256];
+                int port = SERVER_PORT;
+                if (parse_endpoint(server.c_str(), host, sizeof(host), &port) < 0) {
+                    cout << "Invalid server " << server << endl;
+                    exit(1);
+                }
+                options.servers.emplace_back(host, port);
+            }
+        } else if (name == "--dns-ttl") {
+            options.dns_ttl = max(atoi(value.c_str()), 0);
+        } else if (name == "--breaker-failures") {
+            options.breaker_failures = max(atoi(value.c_str()), 1);
+        } else if (name == "--breaker-open") {
+            options.breaker_open_ms = max(atoi(value.c_str()), 1);
+        } else if (name == "--breaker-probes") {
+            options.breaker_probes = max(atoi(value.c_str()), 1);
+        } else if (name == "--rate") {
+            options.rate = atof(value.c_str());
+        } else if (name == "--burst") {
+            options.burst = atof(value.c_str());
+        } else if (name == "--max-concurrency") {
+            options.max_concurrency = atoi(value.c_str());
+        } else if (name == "--threads") {
+            options.threads = max(atoi(value.c_str()), 1);
+        } else if (name == "--workers") {
+            options.workers = max(atoi(value.c_str()), 1);
+        } else if (name == "--transport") {
+            options.transport = value;
+        } else if (name == "--nodelay") {
+            options.sockets.nodelay = value.empty() || atoi(value.c_str());
+        } else if (name == "--quickack") {
+            options.sockets.quickack = value.empty() || atoi(value.c_str());
+        } else if (name == "--fastopen") {
+            options.sockets.fastopen = value.empty() || atoi(value.c_str());
+        } else if (name == "--rcvbuf") {
+            options.sockets.rcvbuf = max(atoi(value.c_str()), 0);
+        } else if (name == "--sndbuf") {
+            options.sockets.sndbuf = max(atoi(value.c_str()), 0);
+        } else if (name == "--compression") {
+            options.compression = value.empty() || atoi(value.c_str());
+        } else if (name == "--record") {
+            options.record = value;
+        } else {
+            cout << "Unknown option " << arg << endl;
+            exit(1);
+        }
+    }
+}
+
+/*  Apply the rate options to a limiter
+*/
+void configure_limiter(RateLimiter &limiter, const Options &options) {
+    limiter.bucket.configure(options.rate, options.burst);
+    limiter.concurrency.configure(4, 1, options.max_concurrency);
+}
 
+int main (int argc, char *argv[]) {
+    Options options;
+    parse_args(argc, argv, options);
+
+    if (options.dns_ttl >= 0)
+        resolver_set_ttl(options.dns_ttl);
+    socket_options_set(&options.sockets);
+    content_decoding_set(options.compression);
+    if (!options.record.empty()) {
+        if (traffic_record_start(options.record.c_str()) < 0)
+            cout << "Cannot write traffic log " << options.record << endl;
+        else
+            atexit(traffic_record_stop);
+    }
+    if (transport_use(options.transport.c_str()) < 0)
+        cout << "Transport " << options.transport << " is not available, using " << transport_current()->name << endl;
+
+    if (options.servers.empty())
+        options.servers.emplace_back(SERVER_IP, SERVER_PORT);
+    LoadBalancer balancer(options.servers);
+    balancer.configure_breakers(options.breaker_failures, chrono::milliseconds(options.breaker_open_ms),
+                                options.breaker_probes);
+    LibraryClient client(balancer);
+    configure_limiter(client.limiter(), options);
+
+    ThreadPool pool(options.workers);
+    Catalog catalog;
 
-int main () {
     // Client loop
-    parse_stdin();
-    
+    parse_stdin(client, balancer, pool, catalog, options);
+
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,222 @@
+// Accept-Encoding negotiation and streaming gzip/deflate decoding of responses
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "content_decoding.h"
+
+#define HEADER_TERMINATOR "\r\n\r\n"
+#define HEADER_TERMINATOR_SIZE (sizeof(HEADER_TERMINATOR) - 1)
+
+// Room left for the decoded Content-Length, filled in once it is known
+#define LENGTH_DIGITS 20
+
+// Largest piece handed to zlib at once (its sizes are 32 bits)
+#define MAX_INFLATE_CHUNK (1u << 30)
+
+// Encodings of the body
+#define ENCODING_NONE 0
+#define ENCODING_GZIP 1
+#define ENCODING_DEFLATE 2
+
+static int decoding_enabled = 1;
+
+void content_decoding_set(int enabled)
+{
+    decoding_enabled = enabled;
+}
+
+int content_decoding_enabled(void)
+{
+    return decoding_enabled;
+}
+
+/*  Returns where the value of a header line starts (past the name, the
+*   colon and any blanks) if the line is the header name, 0 otherwise
+*/
+static size_t header_value(const char *line, size_t length, const char *name)
+{
+    size_t name_length = strlen(name);
+
+    if (length <= name_length || line[name_length] != ':' || strncasecmp(line, name, name_length) != 0)
+        return 0;
+
+    size_t value = name_length + 1;
+    while (value < length && (line[value] == ' ' || line[value] == '\t'))
+        value++;
+    return value;
+}
+
+static int parse_encoding(const char *value, size_t length)
+{
+    while (length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t'))
+        length--;
+
+    if ((length == 4 && strncasecmp(value, "gzip", 4) == 0) || (length == 6 && strncasecmp(value, "x-gzip", 6) == 0))
+        return ENCODING_GZIP;
+    if (length == 7 && strncasecmp(value, "deflate", 7) == 0)
+        return ENCODING_DEFLATE;
+    // identity, or stacked encodings the client does not undo
+    return ENCODING_NONE;
+}
+
+/*  Returns the length of the header line at line, without its line ending,
+*   and sets next to the line after it
+*/
+static size_t line_length(const char *line, const char *end, const char **next)
+{
+    const char *newline = memchr(line, '\n', end - line);
+    if (newline == NULL)
+        newline = end;
+
+    *next = newline + 1;
+    return newline - line - (newline > line && newline[-1] == '\r');
+}
+
+int body_decoder_start(body_decoder *decoder, buffer *raw)
+{
+    int terminator = buffer_find(raw, HEADER_TERMINATOR, HEADER_TERMINATOR_SIZE);
+    if (terminator < 0 || memchr(raw->data, '\n', terminator) == NULL)
+        return 0;
+
+    // Responses that never have a body are left alone
+    const char *space = memchr(raw->data, ' ', terminator);
+    long status = space == NULL ? 0 : strtol(space + 1, NULL, 10);
+    if (status < 200 || status == 204 || status == 304)
+        return 0;
+
+    // The line ending of the last header line is part of the header
+    const char *lines = (const char *) memchr(raw->data, '\n', terminator) + 1;
+    const char *header_end = raw->data + terminator + 2;
+    int encoding = ENCODING_NONE;
+    int has_length = 0;
+
+    for (const char *line = lines, *next; line < header_end; line = next) {
+        size_t length = line_length(line, header_end, &next);
+        size_t value;
+        if ((value = header_value(line, length, "Content-Encoding")) != 0) {
+            encoding = parse_encoding(line + value, length - value);
+        } else if ((value = header_value(line, length, "Content-Length")) != 0) {
+            has_length = 1;
+            if (strtol(line + value, NULL, 10) == 0)
+                return 0;
+        }
+    }
+
+    if (encoding == ENCODING_NONE)
+        return 0;
+
+    memset(decoder, 0, sizeof(*decoder));
+    // 16 + MAX_WBITS only takes a gzip member, MAX_WBITS a zlib stream
+    if (inflateInit2(&decoder->stream, encoding == ENCODING_GZIP ? 16 + MAX_WBITS : MAX_WBITS) != Z_OK)
+        return -1;
+    decoder->deflate = encoding == ENCODING_DEFLATE;
+    decoder->raw_body = terminator + HEADER_TERMINATOR_SIZE;
+
+    // Copy of the header without the lines about the encoded body
+    decoder->decoded = buffer_init();
+    if (buffer_add(&decoder->decoded, raw->data, lines - raw->data) < 0)
+        goto fail;
+
+    for (const char *line = lines, *next; line < header_end; line = next) {
+        size_t length = line_length(line, header_end, &next);
+        if (header_value(line, length, "Content-Encoding") == 0 && header_value(line, length, "Content-Length") == 0) {
+            if (buffer_add(&decoder->decoded, line, length) < 0 || buffer_add(&decoder->decoded, "\r\n", 2) < 0)
+                goto fail;
+        }
+    }
+
+    // Responses that end when the server closes the connection keep no length
+    if (has_length) {
+        if (buffer_add(&decoder->decoded, "Content-Length: ", 16) < 0)
+            goto fail;
+        decoder->length_value = decoder->decoded.size;
+        char *digits = buffer_reserve(&decoder->decoded, LENGTH_DIGITS);
+        if (digits == NULL)
+            goto fail;
+        memset(digits, ' ', LENGTH_DIGITS);
+        decoder->decoded.size += LENGTH_DIGITS;
+        if (buffer_add(&decoder->decoded, "\r\n", 2) < 0)
+            goto fail;
+    }
+    if (buffer_add(&decoder->decoded, "\r\n", 2) < 0)
+        goto fail;
+    decoder->body_start = decoder->decoded.size;
+
+    return 1;
+
+fail:
+    body_decoder_abort(decoder);
+    return -1;
+}
+
+int body_decoder_update(body_decoder *decoder, buffer *raw, size_t end)
+{
+    size_t position = decoder->raw_body + decoder->consumed;
+
+    while (!decoder->ended && position < end) {
+        size_t input = end - position;
+        if (input > MAX_INFLATE_CHUNK)
+            input = MAX_INFLATE_CHUNK;
+
+        // JSON usually shrinks a few times, so the output gets room for that much
+        size_t room = input < MAX_INFLATE_CHUNK / 4 ? input * 4 : MAX_INFLATE_CHUNK;
+        if (room < BUFLEN)
+            room = BUFLEN;
+
+        decoder->stream.next_in = (Bytef *) raw->data + position;
+        decoder->stream.avail_in = input;
+        decoder->stream.next_out = (Bytef *) buffer_reserve(&decoder->decoded, room);
+        decoder->stream.avail_out = room;
+        if (decoder->stream.next_out == NULL)
+            return -1;
+
+        int result = inflate(&decoder->stream, Z_NO_FLUSH);
+        size_t read = input - decoder->stream.avail_in;
+        size_t written = room - decoder->stream.avail_out;
+
+        if (result == Z_DATA_ERROR && decoder->deflate && !decoder->raw_deflate
+            && decoder->stream.total_out == 0) {
+            // Some servers send deflate without the zlib wrapper: start over raw
+            decoder->raw_deflate = 1;
+            if (inflateReset2(&decoder->stream, -MAX_WBITS) != Z_OK)
+                return -1;
+            position = decoder->raw_body;
+            continue;
+        }
+
+        if (result == Z_STREAM_END)
+            decoder->ended = 1;
+        else if (result != Z_OK || (read == 0 && written == 0))
+            return -1;
+
+        position += read;
+        decoder->decoded.size += written;
+    }
+
+    decoder->consumed = position - decoder->raw_body;
+    return 0;
+}
+
+int body_decoder_finish(body_decoder *decoder, buffer *decoded)
+{
+    if (!decoder->ended) {
+        body_decoder_abort(decoder);
+        return -1;
+    }
+
+    if (decoder->length_value != 0) {
+        char digits[LENGTH_DIGITS + 1];
+        snprintf(digits, sizeof(digits), "%-*zu", LENGTH_DIGITS, decoder->decoded.size - decoder->body_start);
+        memcpy(decoder->decoded.data + decoder->length_value, digits, LENGTH_DIGITS);
+    }
+
+    inflateEnd(&decoder->stream);
+    *decoded = decoder->decoded;
+    return 0;
+}
+
+void body_decoder_abort(body_decoder *decoder)
+{
+    inflateEnd(&decoder->stream);
+    buffer_destroy(&decoder->decoded);
+}
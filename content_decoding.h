@@ -0,0 +1,49 @@
+#ifndef _CONTENT_DECODING_
+#define _CONTENT_DECODING_
+
+#include <zlib.h>
+#include "helpers.h"
+
+// Value of the Accept-Encoding header of GET requests
+#define ACCEPT_ENCODING "gzip, deflate"
+
+// sets whether GET requests ask for compressed responses (the default);
+// compressed responses are decoded either way
+void content_decoding_set(int enabled);
+
+// returns whether GET requests ask for compressed responses
+int content_decoding_enabled(void);
+
+// inflates a gzip or deflate response body while it is being received: the
+// decoded response starts with a copy of the header, without its
+// Content-Encoding and with the Content-Length of the decoded body, so the
+// rest of the client never sees the encoding
+typedef struct {
+    z_stream stream;
+    int deflate;                        // deflate, not gzip
+    int raw_deflate;                    // deflate without the zlib wrapper
+    size_t raw_body;                    // body in the raw response
+    size_t consumed;                    // raw body bytes inflated so far
+    buffer decoded;
+    size_t length_value;                // Content-Length value in decoded, 0 if none
+    size_t body_start;                  // body in decoded
+    int ended;                          // the compressed body is complete
+} body_decoder;
+
+// checks the complete header at the start of raw; returns 1 if the body is
+// encoded (every body byte is then fed to body_decoder_update), 0 if it is
+// not (nothing to release) or -1 on error
+int body_decoder_start(body_decoder *decoder, buffer *raw);
+
+// inflates the body bytes of raw from the last call up to end; returns 0
+// or -1 if the body is not valid
+int body_decoder_update(body_decoder *decoder, buffer *raw, size_t end);
+
+// hands the decoded response over to decoded and releases the decoder;
+// returns 0 or -1 (nothing handed over) if the body was cut short
+int body_decoder_finish(body_decoder *decoder, buffer *decoded);
+
+// releases a decoder without finishing it
+void body_decoder_abort(body_decoder *decoder);
+
+#endif
@@ -1,16 +1,23 @@
+#include <limits.h>     /* LONG_MAX */
 #include <stdlib.h>     /* exit, atoi, malloc, free */
 #include <stdio.h>
 #include <unistd.h>     /* read, write, close */
 #include <string.h>     /* memcpy, memset */
 #include <sys/socket.h> /* socket, connect */
 #include <netinet/in.h> /* struct sockaddr_in, struct sockaddr */
+#include <netinet/tcp.h> /* TCP_NODELAY, TCP_QUICKACK, TCP_FASTOPEN_CONNECT */
 #include <netdb.h>      /* struct hostent, gethostbyname */
 #include <arpa/inet.h>
 #include "helpers.h"
+#include "content_decoding.h"
+#include "traffic_log.h"
+#include "resolver.h"
+#include "transport.h"
 
 #define HEADER_TERMINATOR "\r\n\r\n"
 #define HEADER_TERMINATOR_SIZE (sizeof(HEADER_TERMINATOR) - 1)
-#define CONTENT_LENGTH "Content-Length: "
+// Only matches at the start of a header line, not inside another header
+#define CONTENT_LENGTH "\nContent-Length:"
 #define CONTENT_LENGTH_SIZE (sizeof(CONTENT_LENGTH) - 1)
 
 buffer buffer_init(void)
@@ -19,6 +26,7 @@ buffer buffer_init(void)
 
     buffer.data = NULL;
     buffer.size = 0;
+    buffer.capacity = 0;
 
     return buffer;
 }
@@ -31,6 +39,7 @@ void buffer_destroy(buffer *buffer)
     }
 
     buffer->size = 0;
+    buffer->capacity = 0;
 }
 
 int buffer_is_empty(buffer *buffer)
@@ -38,65 +47,301 @@ int buffer_is_empty(buffer *buffer)
     return buffer->data == NULL;
 }
 
-void buffer_add(buffer *buffer, const char *data, size_t data_size)
+char *buffer_reserve(buffer *buffer, size_t data_size)
 {
-    if (buffer->data != NULL) {
-        buffer->data = realloc(buffer->data, (buffer->size + data_size) * sizeof(char));
-    } else {
-        buffer->data = calloc(data_size, sizeof(char));
+    size_t needed = buffer->size + data_size;
+
+    if (buffer->data == NULL || needed > buffer->capacity) {
+        // Grow geometrically so that appending stays linear overall
+        size_t capacity = buffer->capacity * 2;
+        if (capacity < needed)
+            capacity = needed;
+
+        // An absurd size (a forged Content-Length) fails and leaves the buffer as it was
+        char *data = realloc(buffer->data, capacity * sizeof(char));
+        if (data == NULL)
+            return NULL;
+
+        buffer->data = data;
+        buffer->capacity = capacity;
     }
 
-    memcpy(buffer->data + buffer->size, data, data_size);
+    return buffer->data + buffer->size;
+}
+
+int buffer_add(buffer *buffer, const char *data, size_t data_size)
+{
+    char *space = buffer_reserve(buffer, data_size);
+    if (space == NULL)
+        return -1;
 
+    memcpy(space, data, data_size);
     buffer->size += data_size;
+    return 0;
 }
 
-int buffer_find(buffer *buffer, const char *data, size_t data_size)
+/* ASCII case folding, the same as tolower() in the C locale */
+static inline unsigned char fold(unsigned char c)
 {
-    if (data_size > buffer->size)
-        return -1;
+    return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+static int find_scalar(const char *haystack, size_t size, const char *needle, size_t needle_size)
+{
+    const char *end = haystack + size - needle_size + 1;
+    const char *pos = haystack;
+
+    while ((pos = memchr(pos, needle[0], end - pos)) != NULL) {
+        if (memcmp(pos + 1, needle + 1, needle_size - 1) == 0)
+            return pos - haystack;
+        pos++;
+    }
+
+    return -1;
+}
 
-    size_t last_pos = buffer->size - data_size + 1;
+static int find_insensitive_scalar(const char *haystack, size_t size, const char *needle, size_t needle_size)
+{
+    size_t last_pos = size - needle_size + 1;
 
     for (size_t i = 0; i < last_pos; ++i) {
         size_t j;
 
-        for (j = 0; j < data_size; ++j) {
-            if (buffer->data[i + j] != data[j]) {
+        for (j = 0; j < needle_size; ++j) {
+            if (fold(haystack[i + j]) != fold(needle[j])) {
                 break;
             }
         }
 
-        if (j == data_size)
+        if (j == needle_size)
             return i;
     }
 
     return -1;
 }
 
-int buffer_find_insensitive(buffer *buffer, const char *data, size_t data_size)
+/* checks a candidate whose first and last bytes already match */
+static inline int match_insensitive(const char *haystack, const char *needle, size_t needle_size)
 {
-    if (data_size > buffer->size)
-        return -1;
+    for (size_t j = 1; j + 1 < needle_size; ++j) {
+        if (fold(haystack[j]) != fold(needle[j]))
+            return 0;
+    }
 
-    size_t last_pos = buffer->size - data_size + 1;
+    return 1;
+}
 
-    for (size_t i = 0; i < last_pos; ++i) {
-        size_t j;
+#if defined(__x86_64__)
+#include <immintrin.h>
 
-        for (j = 0; j < data_size; ++j) {
-            if (tolower(buffer->data[i + j]) != tolower(data[j])) {
-                break;
-            }
+/*
+ * The vector versions compare a block of candidate positions at once against
+ * the first and the last byte of the needle, and only check the middle of
+ * the needle where both match. The tail shorter than a block is left to the
+ * scalar version.
+ */
+
+static int find_sse2(const char *haystack, size_t size, const char *needle, size_t needle_size)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_size - 1]);
+    size_t i = 0;
+
+    for (; i + needle_size - 1 + 16 <= size; i += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i *) (haystack + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *) (haystack + i + needle_size - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                        _mm_cmpeq_epi8(last, block_last)));
+
+        while (mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(haystack + i + bit + 1, needle + 1, needle_size - 2) == 0)
+                return i + bit;
+            mask &= mask - 1;
         }
+    }
 
-        if (j == data_size)
-            return i;
+    int found = find_scalar(haystack + i, size - i, needle, needle_size);
+    return found < 0 ? -1 : (int) i + found;
+}
+
+static inline __m128i fold_sse2(__m128i block)
+{
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(block, _mm_set1_epi8('Z' + 1)));
+    return _mm_or_si128(block, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static int find_insensitive_sse2(const char *haystack, size_t size, const char *needle, size_t needle_size)
+{
+    const __m128i first = _mm_set1_epi8(fold(needle[0]));
+    const __m128i last = _mm_set1_epi8(fold(needle[needle_size - 1]));
+    size_t i = 0;
+
+    for (; i + needle_size - 1 + 16 <= size; i += 16) {
+        __m128i block_first = fold_sse2(_mm_loadu_si128((const __m128i *) (haystack + i)));
+        __m128i block_last = fold_sse2(_mm_loadu_si128((const __m128i *) (haystack + i + needle_size - 1)));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                        _mm_cmpeq_epi8(last, block_last)));
+
+        while (mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if (match_insensitive(haystack + i + bit, needle, needle_size))
+                return i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    int found = find_insensitive_scalar(haystack + i, size - i, needle, needle_size);
+    return found < 0 ? -1 : (int) i + found;
+}
+
+__attribute__((target("avx2")))
+static int find_avx2(const char *haystack, size_t size, const char *needle, size_t needle_size)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_size - 1]);
+    size_t i = 0;
+
+    for (; i + needle_size - 1 + 32 <= size; i += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *) (haystack + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *) (haystack + i + needle_size - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                                              _mm256_cmpeq_epi8(last, block_last)));
+
+        while (mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(haystack + i + bit + 1, needle + 1, needle_size - 2) == 0)
+                return i + bit;
+            mask &= mask - 1;
+        }
     }
 
+    int found = find_scalar(haystack + i, size - i, needle, needle_size);
+    return found < 0 ? -1 : (int) i + found;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i fold_avx2(__m256i block)
+{
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(block, _mm256_set1_epi8('A' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), block));
+    return _mm256_or_si256(block, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static int find_insensitive_avx2(const char *haystack, size_t size, const char *needle, size_t needle_size)
+{
+    const __m256i first = _mm256_set1_epi8(fold(needle[0]));
+    const __m256i last = _mm256_set1_epi8(fold(needle[needle_size - 1]));
+    size_t i = 0;
+
+    for (; i + needle_size - 1 + 32 <= size; i += 32) {
+        __m256i block_first = fold_avx2(_mm256_loadu_si256((const __m256i *) (haystack + i)));
+        __m256i block_last = fold_avx2(_mm256_loadu_si256((const __m256i *) (haystack + i + needle_size - 1)));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                                              _mm256_cmpeq_epi8(last, block_last)));
+
+        while (mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if (match_insensitive(haystack + i + bit, needle, needle_size))
+                return i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    int found = find_insensitive_scalar(haystack + i, size - i, needle, needle_size);
+    return found < 0 ? -1 : (int) i + found;
+}
+#endif
+
+typedef int (*find_function)(const char *haystack, size_t size, const char *needle, size_t needle_size);
+
+static find_function find_impl = NULL;
+static find_function find_insensitive_impl = NULL;
+static const char *find_impl_name = NULL;
+
+int buffer_find_use(const char *impl)
+{
+    if (impl == NULL) {
+#if defined(__x86_64__)
+        __builtin_cpu_init();
+        impl = __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#else
+        impl = "scalar";
+#endif
+    }
+
+    if (strcmp(impl, "scalar") == 0) {
+        find_impl = find_scalar;
+        find_insensitive_impl = find_insensitive_scalar;
+        find_impl_name = "scalar";
+        return 0;
+    }
+
+#if defined(__x86_64__)
+    if (strcmp(impl, "sse2") == 0) {
+        find_impl = find_sse2;
+        find_insensitive_impl = find_insensitive_sse2;
+        find_impl_name = "sse2";
+        return 0;
+    }
+
+    __builtin_cpu_init();
+    if (strcmp(impl, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        find_impl = find_avx2;
+        find_insensitive_impl = find_insensitive_avx2;
+        find_impl_name = "avx2";
+        return 0;
+    }
+#endif
+
     return -1;
 }
 
+const char *buffer_find_impl(void)
+{
+    if (find_impl == NULL)
+        buffer_find_use(NULL);
+
+    return find_impl_name;
+}
+
+int buffer_find(buffer *buffer, const char *data, size_t data_size)
+{
+    if (data_size > buffer->size)
+        return -1;
+
+    if (data_size == 0)
+        return 0;
+
+    if (find_impl == NULL)
+        buffer_find_use(NULL);
+
+    // The vector versions need distinct first and last bytes to compare
+    if (data_size == 1)
+        return find_scalar(buffer->data, buffer->size, data, data_size);
+
+    return find_impl(buffer->data, buffer->size, data, data_size);
+}
+
+int buffer_find_insensitive(buffer *buffer, const char *data, size_t data_size)
+{
+    if (data_size > buffer->size)
+        return -1;
+
+    if (data_size == 0)
+        return 0;
+
+    if (find_insensitive_impl == NULL)
+        buffer_find_use(NULL);
+
+    if (data_size == 1)
+        return find_insensitive_scalar(buffer->data, buffer->size, data, data_size);
+
+    return find_insensitive_impl(buffer->data, buffer->size, data, data_size);
+}
+
 void error(const char *msg)
 {
     perror(msg);
@@ -109,105 +354,147 @@ void compute_message(char *message, const char *line)
     strcat(message, "\r\n");
 }
 
-int open_connection(const char *host_ip, int portno, int ip_type, int socket_type, int flag)
+static socket_options current_socket_options;
+
+void socket_options_set(const socket_options *options)
 {
-    struct sockaddr_in serv_addr;
-    int sockfd = socket(ip_type, socket_type, flag);
-    if (sockfd < 0)
-        error("ERROR opening socket");
+    current_socket_options = *options;
+}
 
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = ip_type;
-    serv_addr.sin_port = htons(portno);
-    inet_aton(host_ip, &serv_addr.sin_addr);
+socket_options socket_options_get(void)
+{
+    return current_socket_options;
+}
 
-    /* connect the socket */
-    if (connect(sockfd, (struct sockaddr*) &serv_addr, sizeof(serv_addr)) < 0)
-        error("ERROR connecting");
+/*  Options are best effort: a kernel without one of them still connects
+*/
+void socket_options_apply(int sockfd)
+{
+    const socket_options *options = &current_socket_options;
+    int on = 1;
+
+    if (options->nodelay)
+        setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (options->quickack)
+        setsockopt(sockfd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+    if (options->fastopen)
+        setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+    // Buffer sizes must be set before connecting to pick the window scale
+    if (options->rcvbuf > 0)
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &options->rcvbuf, sizeof(options->rcvbuf));
+    if (options->sndbuf > 0)
+        setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &options->sndbuf, sizeof(options->sndbuf));
+}
 
-    return sockfd;
+int open_connection(const char *host_ip, int portno, int ip_type)
+{
+    return connect_host(host_ip, portno, ip_type);
 }
 
 void close_connection(int sockfd)
 {
+    transport_current()->release(sockfd);
     close(sockfd);
 }
 
-void send_to_server(int sockfd, char *message)
+void release_connection(int sockfd)
 {
-    int bytes, sent = 0;
-    int total = strlen(message);
-
-    do
-    {
-        bytes = write(sockfd, message + sent, total - sent);
-        if (bytes < 0) {
-            error("ERROR writing message to socket");
-        }
+    transport_current()->release(sockfd);
+}
 
-        if (bytes == 0) {
-            break;
-        }
+int send_to_server(int sockfd, char *message)
+{
+    size_t size = strlen(message);
 
-        sent += bytes;
-    } while (sent < total);
+    if (transport_current()->send(sockfd, message, size) < 0)
+        return -1;
+    traffic_record_request(message, size);
+    return 0;
 }
 
-char *receive_from_server(int sockfd)
+/*  Size of the response whose header ends at header_end, looking for
+*   Content-Length in the header only: the body may contain the same text
+*/
+static long response_length(const char *data, size_t header_end)
 {
-    char response[BUFLEN];
-    buffer buffer = buffer_init();
-    int header_end = 0;
-    int content_length = 0;
+    // 1xx, 204 and 304 responses end with their header, even when they
+    // carry the Content-Length of the resource they refer to
+    const char *code = memchr(data, ' ', header_end);
+    long status = code != NULL ? strtol(code + 1, NULL, 10) : 0;
+    if ((status >= 100 && status < 200) || status == 204 || status == 304)
+        return header_end;
 
-    do {
-        int bytes = read(sockfd, response, BUFLEN);
+    buffer header = {(char *) data, header_end, header_end};
+    int content_length_start = buffer_find_insensitive(&header, CONTENT_LENGTH, CONTENT_LENGTH_SIZE);
 
-        if (bytes < 0){
-            error("ERROR reading response from socket");
-        }
+    if (content_length_start < 0)
+        return -2;
 
-        if (bytes == 0) {
-            break;
-        }
+    content_length_start += CONTENT_LENGTH_SIZE;
+    long length = strtol(data + content_length_start, NULL, 10);
+    if (length < 0 || length > LONG_MAX - (long) header_end)
+        return -2;
 
-        buffer_add(&buffer, response, (size_t) bytes);
-        
-        header_end = buffer_find(&buffer, HEADER_TERMINATOR, HEADER_TERMINATOR_SIZE);
-
-        if (header_end >= 0) {
-            header_end += HEADER_TERMINATOR_SIZE;
-            
-            int content_length_start = buffer_find_insensitive(&buffer, CONTENT_LENGTH, CONTENT_LENGTH_SIZE);
-            
-            if (content_length_start < 0) {
-                continue;           
-            }
+    return length + header_end;
+}
 
-            content_length_start += CONTENT_LENGTH_SIZE;
-            content_length = strtol(buffer.data + content_length_start, NULL, 10);
-            break;
-        }
-    } while (1);
-    size_t total = content_length + (size_t) header_end;
-    
-    while (buffer.size < total) {
-        int bytes = read(sockfd, response, BUFLEN);
+long http_response_scan(buffer *response, size_t *scanned)
+{
+    // The terminator may straddle the bytes scanned before and the new ones
+    size_t from = *scanned >= HEADER_TERMINATOR_SIZE ? *scanned - (HEADER_TERMINATOR_SIZE - 1) : 0;
+    if (from > response->size)
+        from = response->size;
 
-        if (bytes < 0) {
-            error("ERROR reading response from socket");
-        }
+    buffer window = {response->data + from, response->size - from, response->size - from};
+    int found = buffer_find(&window, HEADER_TERMINATOR, HEADER_TERMINATOR_SIZE);
 
-        if (bytes == 0) {
-            break;
-        }
+    if (found < 0) {
+        *scanned = response->size;
+        return -1;
+    }
+
+    // Scanning again finds the same terminator
+    *scanned = from + found;
+    return response_length(response->data, from + found + HEADER_TERMINATOR_SIZE);
+}
 
-        buffer_add(&buffer, response, (size_t) bytes);
+long http_response_length(buffer *buffer)
+{
+    size_t scanned = 0;
+    return http_response_scan(buffer, &scanned);
+}
+
+char *receive_response(int sockfd, size_t *size)
+{
+    buffer buffer = buffer_init();
+
+    if (transport_current()->receive(sockfd, &buffer) < 0) {
+        traffic_record_response(NULL, 0);
+        buffer_destroy(&buffer);
+        if (size != NULL)
+            *size = 0;
+        return NULL;
     }
-    buffer_add(&buffer, "", 1);
+
+    char *end = buffer_reserve(&buffer, 1);
+    if (end == NULL) {
+        buffer_destroy(&buffer);
+        if (size != NULL)
+            *size = 0;
+        return NULL;
+    }
+
+    *end = '\0';
+    if (size != NULL)
+        *size = buffer.size;
     return buffer.data;
 }
 
+char *receive_from_server(int sockfd)
+{
+    return receive_response(sockfd, NULL);
+}
+
 char *basic_extract_json_response(char *str)
 {
     return strstr(str, "{\"");
@@ -238,6 +525,14 @@ char *compute_get_request(const char *host, const char *url, const char *query_p
     memset(line, LINELEN, 0);
     sprintf(line, "HOST: %s", host);
     compute_message(message, line);
+
+    // Step 2,5: ask for a compressed body, it is inflated while it arrives
+    if (content_decoding_enabled()) {
+        memset(line, 0, LINELEN);
+        sprintf(line, "Accept-Encoding: %s", ACCEPT_ENCODING);
+        compute_message(message, line);
+    }
+
     // Step 3 (optional): add headers and/or cookies, according to the protocol format
     if (cookies != NULL) {
         if (cookies != NULL) {
@@ -253,6 +548,8 @@ char *compute_get_request(const char *host, const char *url, const char *query_p
     }
     // Step 4: add final new line
     compute_message(message, "");
+
+    free(line);
     return message;
 }
 
@@ -349,6 +646,8 @@ char *compute_delete_request(const char *host, const char *url, const char *quer
     }
     // Step 4: add final new line
     compute_message(message, "");
+
+    free(line);
     return message;
 
 }
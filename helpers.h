@@ -12,6 +12,7 @@
 typedef struct {
     char *data;
     size_t size;
+    size_t capacity;
 } buffer;
 
 // initializes a buffer
@@ -20,8 +21,14 @@ buffer buffer_init(void);
 // destroys a buffer
 void buffer_destroy(buffer *buffer);
 
-// adds data of size data_size to a buffer
-void buffer_add(buffer *buffer, const char *data, size_t data_size);
+// makes room for data_size more bytes at the end of a buffer and returns
+// where they go (the size is not changed), or NULL if they cannot be
+// allocated (the buffer is left as it was)
+char *buffer_reserve(buffer *buffer, size_t data_size);
+
+// adds data of size data_size to a buffer, returns 0 or -1 if it cannot
+// be allocated (the buffer is left as it was)
+int buffer_add(buffer *buffer, const char *data, size_t data_size);
 
 // checks if a buffer is empty
 int buffer_is_empty(buffer *buffer);
@@ -33,24 +40,73 @@ int buffer_find(buffer *buffer, const char *data, size_t data_size);
 // case-insensitive fashion and returns its position
 int buffer_find_insensitive(buffer *buffer, const char *data, size_t data_size);
 
-// shows the current error
+// selects the implementation used by buffer_find and buffer_find_insensitive:
+// "scalar", "sse2", "avx2" or NULL for the best one the CPU supports;
+// returns -1 if it is not available
+int buffer_find_use(const char *impl);
+
+// returns the name of the implementation in use
+const char *buffer_find_impl(void);
+
+// shows the current error and exits (only for errors the client cannot
+// go on after; the network functions below return an error instead)
 void error(const char *msg);
 
 // adds a line to a string message
 void compute_message(char *message, const char *line);
 
-// opens a connection with server host_ip on port portno, returns a socket
-int open_connection(const char *host_ip, int portno, int ip_type, int socket_type, int flag);
+// options set on every socket the client opens; zero keeps the system default
+typedef struct {
+    int nodelay;        // TCP_NODELAY: send small writes at once (no Nagle)
+    int quickack;       // TCP_QUICKACK: acknowledge responses without delay
+    int rcvbuf;         // SO_RCVBUF, in bytes
+    int sndbuf;         // SO_SNDBUF, in bytes
+    int fastopen;       // TCP_FASTOPEN_CONNECT: send the request with the SYN
+                        // when the server handed out a cookie before
+} socket_options;
+
+// replaces the options of the sockets opened from now on
+void socket_options_set(const socket_options *options);
+
+// returns the options in use
+socket_options socket_options_get(void);
+
+// sets the options in use on a socket, before it connects
+void socket_options_apply(int sockfd);
+
+// opens a connection with server host_ip (a name or an address) on port
+// portno, ip_type being AF_INET, AF_INET6 or AF_UNSPEC for either; returns
+// a blocking TCP socket or -1 (errno set)
+int open_connection(const char *host_ip, int portno, int ip_type);
 
 // closes a server connection on socket sockfd
 void close_connection(int sockfd);
 
-// send a message to a server
-void send_to_server(int sockfd, char *message);
+// keeps a server connection open for any thread to use next (before it
+// goes back to a pool)
+void release_connection(int sockfd);
+
+// send a message to a server, returns 0 or -1 on error
+int send_to_server(int sockfd, char *message);
 
-// receives and returns the message from a server
+// returns the total size of the HTTP response at the start of a buffer,
+// -1 if its header is not complete yet or -2 if it has no Content-Length
+// (the response then ends when the server closes the connection); 1xx,
+// 204 and 304 responses are only a header
+long http_response_length(buffer *buffer);
+
+// same for a buffer that grows while the response arrives: scanned keeps
+// how far the header was searched (0 at first), so every byte is looked at
+// about once however finely the response is split
+long http_response_scan(buffer *response, size_t *scanned);
+
+// receives and returns the message from a server, NULL on error
 char *receive_from_server(int sockfd);
 
+// receives and returns the message from a server, NUL-terminated, and
+// stores its size (without the NUL) in size; NULL (size 0) on error
+char *receive_response(int sockfd, size_t *size);
+
 // extracts and returns a JSON from a server response
 char *basic_extract_json_response(char *str);
 
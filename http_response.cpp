@@ -0,0 +1,146 @@
+// Single-pass HTTP response parser
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "http_response.hpp"
+
+using namespace std;
+
+static bool equals_insensitive(string_view a, string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+// Strip spaces and tabs around a header value
+static string_view trim(string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r'))
+        s.remove_suffix(1);
+    return s;
+}
+
+string_view HttpResponse::header(string_view name) const {
+    for (const auto &header : headers) {
+        if (equals_insensitive(header.first, name))
+            return header.second;
+    }
+    return {};
+}
+
+string_view HttpResponse::cookie(string_view name) const {
+    for (string_view value : cookies) {
+        string_view pair = value.substr(0, value.find(';'));
+        if (pair.size() > name.size() && pair.compare(0, name.size(), name) == 0 && pair[name.size()] == '=')
+            return pair;
+    }
+    return {};
+}
+
+/*  Walk the response line by line: the status line, then one header per
+*   line until the empty line that starts the body
+*/
+HttpResponse parse_http_response(string_view raw) {
+    HttpResponse response;
+    size_t pos = raw.find('\n');
+
+    // Status line: HTTP/1.1 200 OK
+    if (pos == string_view::npos || raw.compare(0, 5, "HTTP/") != 0)
+        return response;
+
+    string_view status_line = trim(raw.substr(0, pos));
+    size_t code = status_line.find(' ');
+    if (code == string_view::npos || status_line.size() < code + 4)
+        return response;
+
+    int status = 0;
+    for (size_t i = code + 1; i < code + 4; ++i) {
+        if (status_line[i] < '0' || status_line[i] > '9')
+            return response;
+        status = status * 10 + status_line[i] - '0';
+    }
+    response.reason = trim(status_line.substr(code + 4));
+
+    // Header lines
+    long content_length = -1;
+    bool http_1_1 = raw.compare(0, 8, "HTTP/1.1") == 0;
+    string_view connection;
+    pos++;
+    while (true) {
+        size_t end = raw.find('\n', pos);
+        if (end == string_view::npos) {
+            response.headers.clear();
+            response.cookies.clear();
+            return response;
+        }
+
+        string_view line = raw.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (line.empty() || line == "\r")
+            break;
+
+        size_t colon = line.find(':');
+        if (colon == string_view::npos)
+            continue;
+
+        string_view name = line.substr(0, colon);
+        string_view value = trim(line.substr(colon + 1));
+        response.headers.emplace_back(name, value);
+
+        if (equals_insensitive(name, "Set-Cookie"))
+            response.cookies.push_back(value);
+        else if (equals_insensitive(name, "Content-Length"))
+            content_length = strtol(value.data(), NULL, 10);
+        else if (equals_insensitive(name, "Connection"))
+            connection = value;
+    }
+
+    // Some responses never have a body, whatever their header says
+    if ((status >= 100 && status < 200) || status == 204 || status == 304)
+        content_length = 0;
+
+    // Without a length the body ends when the server closes the connection
+    if (content_length >= 0)
+        response.keep_alive = http_1_1 ? !equals_insensitive(connection, "close")
+                                       : equals_insensitive(connection, "keep-alive");
+
+    response.status = status;
+    response.body = raw.substr(pos);
+    if (content_length >= 0 && (size_t) content_length < response.body.size())
+        response.body = response.body.substr(0, content_length);
+
+    return response;
+}
+
+Response::Response(char *data, size_t size)
+    : data(data), size(size), parsed(parse_http_response(raw()))
+{
+}
+
+Response::Response(Response &&other)
+    : data(other.data), size(other.size), parsed(std::move(other.parsed))
+{
+    other.data = NULL;
+    other.size = 0;
+    other.parsed = HttpResponse();
+}
+
+Response &Response::operator=(Response &&other)
+{
+    if (this != &other) {
+        free(data);
+        data = other.data;
+        size = other.size;
+        parsed = std::move(other.parsed);
+
+        other.data = NULL;
+        other.size = 0;
+        other.parsed = HttpResponse();
+    }
+    return *this;
+}
+
+Response::~Response()
+{
+    free(data);
+}
@@ -0,0 +1,55 @@
+#ifndef _HTTP_RESPONSE_
+#define _HTTP_RESPONSE_
+
+#include <stdlib.h>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// HTTP response split into its parts; every view points into the buffer
+// that was parsed, which must outlive it
+struct HttpResponse {
+    int status = 0;         // 0 if the buffer is not a complete response header
+    std::string_view reason;
+    std::vector<std::pair<std::string_view, std::string_view>> headers;
+    std::vector<std::string_view> cookies;     // Set-Cookie values
+    std::string_view body;
+    bool keep_alive = false;    // the connection can carry another request
+
+    // returns the value of the first header called name (case-insensitive),
+    // or an empty view
+    std::string_view header(std::string_view name) const;
+
+    // returns the value of a cookie set by the response (without attributes)
+    std::string_view cookie(std::string_view name) const;
+
+    bool ok() const { return status >= 200 && status < 300; }
+};
+
+// response received from the server: owns the NUL-terminated buffer it was
+// read into (allocated with malloc) and the parsed views into it, so the
+// bytes are never copied after read(); moving it keeps the views valid
+class Response {
+public:
+    Response() : data(NULL), size(0) {}
+    Response(char *data, size_t size);
+    Response(Response &&other);
+    Response &operator=(Response &&other);
+    Response(const Response &) = delete;
+    ~Response();
+
+    const HttpResponse &http() const { return parsed; }
+    std::string_view raw() const { return std::string_view(data != NULL ? data : "", size); }
+
+private:
+    char *data;
+    size_t size;
+    HttpResponse parsed;
+};
+
+// parses the status line, the headers and the body of raw in a single pass;
+// the body is cut to Content-Length when the header is present (and is
+// empty for 1xx, 204 and 304)
+HttpResponse parse_http_response(std::string_view raw);
+
+#endif
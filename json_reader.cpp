@@ -0,0 +1,264 @@
+// On-demand JSON reader for the fixed response schemas of the server
+#include "json_reader.hpp"
+
+using namespace std;
+
+#define NPOS string_view::npos
+
+static size_t skip_space(string_view s, size_t pos) {
+    while (pos < s.size() && (s[pos] == ' ' || s[pos] == '\t' || s[pos] == '\n' || s[pos] == '\r'))
+        pos++;
+    return pos;
+}
+
+// Position after the closing quote of the string starting at pos
+static size_t skip_string(string_view s, size_t pos) {
+    for (pos++; pos < s.size(); pos++) {
+        if (s[pos] == '\\')
+            pos++;
+        else if (s[pos] == '"')
+            return pos + 1;
+    }
+    return NPOS;
+}
+
+/*  Position after the value starting at pos, or NPOS if it is malformed
+*   Objects and arrays are only matched bracket by bracket: their members are
+*   looked at when (and if) somebody asks for them
+*/
+static size_t skip_value(string_view s, size_t pos) {
+    if (pos >= s.size())
+        return NPOS;
+
+    if (s[pos] == '"')
+        return skip_string(s, pos);
+
+    if (s[pos] == '{' || s[pos] == '[') {
+        int depth = 0;
+        while (pos < s.size()) {
+            char c = s[pos];
+            if (c == '"') {
+                pos = skip_string(s, pos);
+                if (pos == NPOS)
+                    return NPOS;
+                continue;
+            }
+            if (c == '{' || c == '[')
+                depth++;
+            else if (c == '}' || c == ']') {
+                if (--depth == 0)
+                    return pos + 1;
+            }
+            pos++;
+        }
+        return NPOS;
+    }
+
+    // Number, true, false or null
+    size_t start = pos;
+    while (pos < s.size() && s[pos] != ',' && s[pos] != '}' && s[pos] != ']'
+           && s[pos] != ' ' && s[pos] != '\t' && s[pos] != '\n' && s[pos] != '\r')
+        pos++;
+    return pos > start ? pos : NPOS;
+}
+
+// Keep text only if it holds exactly one value that opens with bracket
+static string_view whole_value(string_view text, char bracket) {
+    size_t start = skip_space(text, 0);
+    if (start >= text.size() || text[start] != bracket)
+        return {};
+
+    size_t end = skip_value(text, start);
+    if (end == NPOS || skip_space(text, end) != text.size())
+        return {};
+    return text.substr(start, end - start);
+}
+
+static void append_utf8(string &out, unsigned long code) {
+    if (code < 0x80) {
+        out += (char) code;
+    } else if (code < 0x800) {
+        out += (char) (0xC0 | (code >> 6));
+        out += (char) (0x80 | (code & 0x3F));
+    } else if (code < 0x10000) {
+        out += (char) (0xE0 | (code >> 12));
+        out += (char) (0x80 | ((code >> 6) & 0x3F));
+        out += (char) (0x80 | (code & 0x3F));
+    } else {
+        out += (char) (0xF0 | (code >> 18));
+        out += (char) (0x80 | ((code >> 12) & 0x3F));
+        out += (char) (0x80 | ((code >> 6) & 0x3F));
+        out += (char) (0x80 | (code & 0x3F));
+    }
+}
+
+static bool read_hex4(string_view s, size_t pos, unsigned long &code) {
+    if (pos + 4 > s.size())
+        return false;
+
+    code = 0;
+    for (size_t i = pos; i < pos + 4; ++i) {
+        char c = s[i];
+        code <<= 4;
+        if (c >= '0' && c <= '9')
+            code |= c - '0';
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            code |= (c | 0x20) - 'a' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+/*  Decode the contents of a quoted string (without the quotes)
+*   Strings with no escape sequence, which is all of them for valid inputs,
+*   are assigned in one go
+*/
+static bool decode_string(string_view s, string &out) {
+    if (s.find('\\') == NPOS) {
+        out.assign(s.data(), s.size());
+        return true;
+    }
+
+    string decoded;
+    decoded.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        if (s[i] != '\\') {
+            decoded += s[i];
+            continue;
+        }
+        if (++i >= s.size())
+            return false;
+
+        switch (s[i]) {
+        case '"': decoded += '"'; break;
+        case '\\': decoded += '\\'; break;
+        case '/': decoded += '/'; break;
+        case 'b': decoded += '\b'; break;
+        case 'f': decoded += '\f'; break;
+        case 'n': decoded += '\n'; break;
+        case 'r': decoded += '\r'; break;
+        case 't': decoded += '\t'; break;
+        case 'u': {
+            unsigned long code, low;
+            if (!read_hex4(s, i + 1, code))
+                return false;
+            i += 4;
+
+            // A high surrogate is followed by the low half of the pair
+            if (code >= 0xD800 && code < 0xDC00 && i + 2 < s.size() && s[i + 1] == '\\' && s[i + 2] == 'u'
+                && read_hex4(s, i + 3, low) && low >= 0xDC00 && low < 0xE000) {
+                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                i += 6;
+            }
+            append_utf8(decoded, code);
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+
+    out = std::move(decoded);
+    return true;
+}
+
+/*  Parse an integer (the fraction of a number is dropped)
+*/
+static bool parse_int(string_view s, int &out) {
+    size_t i = 0;
+    bool negative = false;
+    if (i < s.size() && s[i] == '-') {
+        negative = true;
+        i++;
+    }
+    if (i >= s.size() || s[i] < '0' || s[i] > '9')
+        return false;
+
+    long value = 0;
+    for (; i < s.size() && s[i] >= '0' && s[i] <= '9'; ++i) {
+        if (value < 1000000000000L)
+            value = value * 10 + s[i] - '0';
+    }
+
+    out = (int) (negative ? -value : value);
+    return true;
+}
+
+JsonObject::JsonObject(string_view text)
+    : text(whole_value(text, '{'))
+{
+}
+
+/*  Walk the members of the object until key comes up
+*   Keys are compared as they are written, the schemas have no escaped keys
+*/
+string_view JsonObject::find(string_view key) const {
+    size_t pos = skip_space(text, 1);
+
+    while (pos < text.size() && text[pos] == '"') {
+        size_t key_end = skip_string(text, pos);
+        if (key_end == NPOS)
+            return {};
+        string_view name = text.substr(pos + 1, key_end - pos - 2);
+
+        pos = skip_space(text, key_end);
+        if (pos >= text.size() || text[pos] != ':')
+            return {};
+
+        size_t value = skip_space(text, pos + 1);
+        size_t value_end = skip_value(text, value);
+        if (value_end == NPOS)
+            return {};
+
+        if (name == key)
+            return text.substr(value, value_end - value);
+
+        pos = skip_space(text, value_end);
+        if (pos >= text.size() || text[pos] != ',')
+            return {};
+        pos = skip_space(text, pos + 1);
+    }
+
+    return {};
+}
+
+bool JsonObject::get_string(string_view key, string &out) const {
+    string_view value = find(key);
+    if (value.size() < 2 || value.front() != '"')
+        return false;
+    return decode_string(value.substr(1, value.size() - 2), out);
+}
+
+bool JsonObject::get_int(string_view key, int &out) const {
+    return parse_int(find(key), out);
+}
+
+bool JsonObject::get_count(string_view key, int &out) const {
+    string_view value = find(key);
+    if (value.size() >= 2 && value.front() == '"')
+        value = value.substr(1, value.size() - 2);
+    return parse_int(value, out);
+}
+
+JsonArray::JsonArray(string_view text)
+    : text(whole_value(text, '[')), pos(1)
+{
+}
+
+bool JsonArray::next(string_view &element) {
+    pos = skip_space(text, pos);
+    if (pos >= text.size() || text[pos] == ']')
+        return false;
+
+    size_t end = skip_value(text, pos);
+    if (end == NPOS)
+        return false;
+    element = text.substr(pos, end - pos);
+
+    // Step over the comma, if any, so the next call starts at an element
+    pos = skip_space(text, end);
+    if (pos < text.size() && text[pos] == ',')
+        pos++;
+    return true;
+}
@@ -0,0 +1,48 @@
+#ifndef _JSON_READER_
+#define _JSON_READER_
+
+#include <string>
+#include <string_view>
+
+// on-demand view of a JSON object: values are found by scanning the raw
+// text when asked for, no DOM is built and nothing is allocated
+class JsonObject {
+public:
+    explicit JsonObject(std::string_view text);
+
+    // true if the text is a single well-formed object
+    bool valid() const { return !text.empty(); }
+
+    // returns the raw text of the value of key (strings keep their quotes),
+    // or an empty view if there is no such member
+    std::string_view find(std::string_view key) const;
+
+    // read the value of key into out; return false (leaving out as it was)
+    // if it is missing or of another type
+    bool get_string(std::string_view key, std::string &out) const;
+    bool get_int(std::string_view key, int &out) const;
+
+    // like get_int, but also accepts a number sent as a string ("120")
+    bool get_count(std::string_view key, int &out) const;
+
+private:
+    std::string_view text;
+};
+
+// forward-only cursor over the elements of a JSON array
+class JsonArray {
+public:
+    explicit JsonArray(std::string_view text);
+
+    // true if the text is a single well-formed array
+    bool valid() const { return !text.empty(); }
+
+    // moves to the next element and returns its raw text, false at the end
+    bool next(std::string_view &element);
+
+private:
+    std::string_view text;
+    size_t pos;
+};
+
+#endif
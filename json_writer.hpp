@@ -0,0 +1,60 @@
+#ifndef _JSON_WRITER_
+#define _JSON_WRITER_
+
+#include <string.h>
+#include <string_view>
+
+// JSON object with a fixed list of keys and string values, written straight
+// into a caller's buffer; the keys and punctuation are measured at compile
+// time, so only the values are left to count. Values must need no escaping
+// (everything that passes is_string_valid)
+template <size_t N>
+class JsonSchema {
+public:
+    constexpr JsonSchema(const char *const (&names)[N])
+        : keys{}, fixed(2 + (N - 1))
+    {
+        for (size_t i = 0; i < N; ++i) {
+            keys[i] = names[i];
+            // "key":"" around every value
+            fixed += keys[i].size() + 5;
+        }
+    }
+
+    // exact length of the object holding values
+    size_t length(const std::string_view (&values)[N]) const {
+        size_t total = fixed;
+        for (size_t i = 0; i < N; ++i)
+            total += values[i].size();
+        return total;
+    }
+
+    // writes the object to out (length() bytes, no NUL), returns its end
+    char *write(char *out, const std::string_view (&values)[N]) const {
+        *out++ = '{';
+        for (size_t i = 0; i < N; ++i) {
+            if (i > 0)
+                *out++ = ',';
+            *out++ = '"';
+            out = copy(out, keys[i]);
+            *out++ = '"';
+            *out++ = ':';
+            *out++ = '"';
+            out = copy(out, values[i]);
+            *out++ = '"';
+        }
+        *out++ = '}';
+        return out;
+    }
+
+private:
+    static char *copy(char *out, std::string_view s) {
+        memcpy(out, s.data(), s.size());
+        return out + s.size();
+    }
+
+    std::string_view keys[N];
+    size_t fixed;
+};
+
+#endif
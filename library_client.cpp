@@ -0,0 +1,268 @@
+// Blocking client for the library server API
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include "library_client.hpp"
+
+extern "C" {
+  #include "helpers.h"
+  #include "resolver.h"
+}
+
+using namespace std;
+
+// Books whose validators are kept, the cache starts over when it is full
+#define MAX_CACHED_BOOKS 4096
+
+LibraryClient::LibraryClient(const string &host, int port)
+    : own_balancer(make_unique<LoadBalancer>(host, port)), balancer(own_balancer.get()), host(host)
+{
+}
+
+LibraryClient::LibraryClient(LoadBalancer &balancer)
+    : balancer(&balancer), host(balancer.host())
+{
+}
+
+/*  Exchange a request over a connection to endpoint: a pooled one when
+*   there is one, replaced by a new one if the server closed it just before
+*   the request, like AsyncConnection::request does
+*   Returns an empty response (status 0) on failure, with connected set to
+*   false if no connection could be made at all
+*/
+static Response exchange(Endpoint &endpoint, const char *message, bool &connected) {
+    bool reused;
+    int sockfd = endpoint.acquire(reused);
+    connected = sockfd >= 0;
+
+    while (sockfd >= 0) {
+        size_t size = 0;
+        char *received = NULL;
+        if (send_to_server(sockfd, (char *) message) == 0)
+            received = receive_response(sockfd, &size);
+
+        if (size > 0) {
+            Response response(received, size);
+            endpoint.release(sockfd, response.http().keep_alive);
+            return response;
+        }
+
+        free(received);
+        close_connection(sockfd);
+        if (!reused)
+            break;
+
+        reused = false;
+        sockfd = connect_host(endpoint.host.c_str(), endpoint.port, AF_UNSPEC);
+    }
+
+    return Response();
+}
+
+/*  Send a request to the server and return its parsed response
+*   Waits for the rate limiter before connecting and reports the outcome back to it
+*   The request goes to the replica picked by the balancer; a replica whose
+*   circuit breaker is open or that cannot be reached is skipped for the
+*   next one, and with every breaker open the request fails right away,
+*   without waiting for the rate limiter
+*/
+Response LibraryClient::sendRequest(const char *message) {
+    if (!balancer->available())
+        return Response();
+
+    RateLimiter::Permit permit = rate_limiter.acquire();
+
+    Response response;
+    Endpoint *endpoint = NULL;
+    long ticket;
+    bool sent = false;
+    for (size_t tries = 0; tries < balancer->size(); ++tries) {
+        endpoint = tries == 0 ? &balancer->pick() : &balancer->next(*endpoint);
+        if (!endpoint->start(ticket))
+            continue;
+
+        sent = true;
+        bool connected;
+        response = exchange(*endpoint, message, connected);
+        endpoint->finish(ticket, !is_replica_failure(response.http().status));
+        if (connected)
+            break;
+    }
+
+    // Breakers that opened in the meantime say nothing of the server load
+    if (sent)
+        permit.complete(!is_overloaded(response.http()));
+    else
+        permit.cancel();
+    return response;
+}
+
+/*  Post request to register a new user
+*/
+Status LibraryClient::registerUser(const string &username, const string &password) {
+    char *message = register_request(host, username, password);
+    if (message == NULL)
+        return Status::InvalidInput;
+
+    Response response = sendRequest(message);
+    free(message);
+
+    return register_status(response.http());
+}
+
+/*  Post request to login an existing user
+*   Keeps the session cookie on success
+*/
+Status LibraryClient::login(const string &username, const string &password) {
+    char *message = login_request(host, username, password);
+    if (message == NULL)
+        return Status::InvalidInput;
+
+    Response response = sendRequest(message);
+    free(message);
+
+    return login_status(response.http(), cookie);
+}
+
+/* Get request for library access
+*  Keeps the JWT token if access is granted
+*/
+Status LibraryClient::enterLibrary() {
+    token.clear();
+    if (!loggedIn())
+        return Status::Unauthorized;
+
+    char *message = access_request(host, session());
+    Response response = sendRequest(message);
+    free(message);
+
+    return access_status(response.http(), token);
+}
+
+/*  Get request for all books in the library
+*   Conditional on the validators of the cached catalog: a 304 means the
+*   catalog did not change, so it is served from the cache
+*/
+Result<vector<Book>> LibraryClient::getBooks() {
+    Result<vector<Book>> result = {Status::Ok, {}};
+
+    Validators validators;
+    {
+        lock_guard<mutex> lock(cache_mutex);
+        validators = books_cache.validators;
+    }
+
+    char *message = books_request(host, jwt(), &validators);
+    Response response = sendRequest(message);
+    free(message);
+
+    bool not_modified = response.http().status == 304 && !validators.empty();
+    if (!not_modified)
+        result.status = books_status(response.http(), result.value);
+
+    lock_guard<mutex> lock(cache_mutex);
+    if (not_modified) {
+        result.value = books_cache.value;
+        return result;
+    }
+
+    // A full answer replaces the cache, which only keeps what can be revalidated
+    if (result.status == Status::NoResponse)
+        return result;
+
+    Validators received = result.ok() ? response_validators(response.http()) : Validators();
+    books_cache = {received, received.empty() ? vector<Book>() : result.value};
+    return result;
+}
+
+/*  Get request for a book with a given id
+*   Conditional like getBooks, with one cache entry per book
+*/
+Result<Book> LibraryClient::getBook(int id) {
+    Result<Book> result = {Status::Ok, {}};
+
+    Validators validators;
+    {
+        lock_guard<mutex> lock(cache_mutex);
+        auto cached = book_cache.find(id);
+        if (cached != book_cache.end())
+            validators = cached->second.validators;
+    }
+
+    char *message = book_request(host, id, jwt(), &validators);
+    Response response = sendRequest(message);
+    free(message);
+
+    result.value.id = id;
+    bool not_modified = response.http().status == 304 && !validators.empty();
+    if (!not_modified)
+        result.status = book_status(response.http(), result.value);
+
+    lock_guard<mutex> lock(cache_mutex);
+    auto cached = book_cache.find(id);
+    if (not_modified) {
+        // The entry may have been dropped by another thread meanwhile
+        if (cached != book_cache.end())
+            result.value = cached->second.value;
+        else
+            result.status = Status::NoResponse;
+        return result;
+    }
+
+    // A full answer replaces the entry, which is only kept if it can be revalidated
+    if (result.status == Status::NoResponse)
+        return result;
+    if (cached != book_cache.end())
+        book_cache.erase(cached);
+
+    Validators received = result.ok() ? response_validators(response.http()) : Validators();
+    if (!received.empty()) {
+        if (book_cache.size() >= MAX_CACHED_BOOKS)
+            book_cache.clear();
+        book_cache.emplace(id, Cached<Book>{received, result.value});
+    }
+    return result;
+}
+
+/*  Post request to add a book to the library
+*/
+Status LibraryClient::addBook(const Book &book) {
+    char *message = add_book_request(host, book, jwt());
+    if (message == NULL)
+        return Status::InvalidInput;
+
+    Response response = sendRequest(message);
+    free(message);
+
+    return add_book_status(response.http());
+}
+
+/* Delete request to delete a book from the library
+*/
+Status LibraryClient::deleteBook(int id) {
+    char *message = delete_book_request(host, id, jwt());
+    Response response = sendRequest(message);
+    free(message);
+
+    return delete_book_status(response.http());
+}
+
+/*  Get request to logout
+*   The cookie and the token are dropped whatever the server answers
+*/
+Status LibraryClient::logout() {
+    char *message = logout_request(host, session());
+    Response response = sendRequest(message);
+    free(message);
+
+    cookie.clear();
+    token.clear();
+    forgetCache();
+
+    return logout_status(response.http());
+}
+
+void LibraryClient::forgetCache() {
+    lock_guard<mutex> lock(cache_mutex);
+    books_cache = {};
+    book_cache.clear();
+}
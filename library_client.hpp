@@ -0,0 +1,87 @@
+#ifndef _LIBRARY_CLIENT_
+#define _LIBRARY_CLIENT_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "library_protocol.hpp"
+#include "load_balancer.hpp"
+#include "rate_limiter.hpp"
+
+// client for the library server; keeps the session cookie and the library
+// token of one user and never writes to stdout
+class LibraryClient {
+public:
+    LibraryClient(const std::string &host, int port);
+
+    // spreads the requests over the replicas of balancer, which may be
+    // shared with other clients and must outlive this one
+    explicit LibraryClient(LoadBalancer &balancer);
+
+    Status registerUser(const std::string &username, const std::string &password);
+
+    // logs in and keeps the session cookie
+    Status login(const std::string &username, const std::string &password);
+
+    // requests library access and keeps the JWT token
+    Status enterLibrary();
+
+    // returns the id and title of every book; once the server sent
+    // validators (ETag, Last-Modified) the request is conditional and an
+    // unchanged catalog (304 Not Modified) is served from the cache
+    Result<std::vector<Book>> getBooks();
+
+    // same for the details of a book
+    Result<Book> getBook(int id);
+
+    // adds a book (the id is ignored)
+    Status addBook(const Book &book);
+
+    Status deleteBook(int id);
+
+    // logs out and forgets the cookie, the token and the cached books
+    Status logout();
+
+    bool loggedIn() const { return !cookie.empty(); }
+    bool hasLibraryAccess() const { return !token.empty(); }
+
+    // session cookie and library token, empty while not set
+    const std::string &sessionCookie() const { return cookie; }
+    const std::string &accessToken() const { return token; }
+
+    // limiter every request of this client passes through
+    RateLimiter &limiter() { return rate_limiter; }
+
+private:
+    // sends a request and returns the parsed response
+    Response sendRequest(const char *message);
+
+    // cookie and token to send, NULL while not set
+    const char *session() const { return cookie.empty() ? NULL : cookie.c_str(); }
+    const char *jwt() const { return token.empty() ? NULL : token.c_str(); }
+
+    // value of the last full response to a GET, with its validators
+    template <typename T>
+    struct Cached {
+        Validators validators;
+        T value;
+    };
+
+    // drops everything cached
+    void forgetCache();
+
+    std::unique_ptr<LoadBalancer> own_balancer;
+    LoadBalancer *balancer;
+    std::string host;
+    std::string cookie;
+    std::string token;
+    RateLimiter rate_limiter;
+
+    std::mutex cache_mutex;
+    Cached<std::vector<Book>> books_cache;
+    std::unordered_map<int, Cached<Book>> book_cache;
+};
+
+#endif
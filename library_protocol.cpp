@@ -0,0 +1,281 @@
+// Requests and responses of the library server API
+#include <stdio.h>
+#include <stdlib.h>
+#include "json_reader.hpp"
+#include "json_writer.hpp"
+#include "library_protocol.hpp"
+
+extern "C" {
+  #include "helpers.h"
+}
+
+using namespace std;
+
+/* Check if string is a valid input:
+*  allowed characters: alphanumeric, underscore, dot, dash
+*/
+bool is_string_valid(const string &s) {
+    for (unsigned long i = 0; i < s.length(); ++i) {
+        if (!isalnum(s[i]) && s[i] != '_' && s[i] != '.' && s[i] != '-') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*  Check if string is a valid number:
+*   allowed characters: digits
+*/
+bool is_number_valid(const string &s) {
+    for (unsigned long i = 0; i < s.length(); ++i) {
+        if (!isdigit(s[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*  Check if the server throttled or failed a request:
+*   429 Too Many Requests, 5xx and unreadable responses count as drops for the limiter
+*/
+bool is_overloaded(const HttpResponse &response) {
+    return response.status == 0 || response.status == 429 || response.status >= 500;
+}
+
+Validators response_validators(const HttpResponse &response) {
+    return {string(response.header("ETag")), string(response.header("Last-Modified"))};
+}
+
+/*  Map the status code of a response: success, the given error for 4xx
+*   (404 has its own status) and no response for anything else
+*/
+static Status classify(const HttpResponse &response, Status client_error) {
+    if (response.ok())
+        return Status::Ok;
+    if (response.status == 404)
+        return Status::NotFound;
+    if (response.status >= 400 && response.status < 500)
+        return client_error;
+    return Status::NoResponse;
+}
+
+static constexpr const char *CREDENTIALS_KEYS[] = {"username", "password"};
+static constexpr JsonSchema<2> CREDENTIALS(CREDENTIALS_KEYS);
+
+static constexpr const char *BOOK_KEYS[] = {"title", "author", "genre", "page_count", "publisher"};
+static constexpr JsonSchema<5> BOOK(BOOK_KEYS);
+
+/*  Post request with a JSON body, in one allocation of its exact length:
+*   the header is printed first, then the body is written right after it
+*   Same header lines as compute_post_request
+*/
+template <size_t N>
+static char *json_post_request(const string &host, const char *url, const JsonSchema<N> &schema,
+                               const string_view (&values)[N], const char *token) {
+    size_t body_length = schema.length(values);
+
+    const char *auth = token != NULL ? "Authorization: Bearer " : "";
+    const char *auth_end = token != NULL ? "\r\n" : "";
+    if (token == NULL)
+        token = "";
+
+    const char *format = "POST %s HTTP/1.1\r\n%s%s%sHOST: %s\r\nContent-Type: application/json\r\n"
+                         "Content-Length: %zu\r\n\r\n";
+    int header_length = snprintf(NULL, 0, format, url, auth, token, auth_end, host.c_str(), body_length);
+
+    char *message = (char *) malloc(header_length + body_length + 1);
+    if (message == NULL)
+        return NULL;
+    snprintf(message, header_length + 1, format, url, auth, token, auth_end, host.c_str(), body_length);
+    *schema.write(message + header_length, values) = '\0';
+
+    return message;
+}
+
+/*  Post request with the credentials of a user
+*/
+static char *credentials_request(const string &host, const char *url, const string &username, const string &password) {
+    if (!is_string_valid(username) || !is_string_valid(password))
+        return NULL;
+
+    const string_view values[] = {username, password};
+    return json_post_request(host, url, CREDENTIALS, values, NULL);
+}
+
+char *register_request(const string &host, const string &username, const string &password) {
+    return credentials_request(host, API_PREFIX "/auth/register", username, password);
+}
+
+char *login_request(const string &host, const string &username, const string &password) {
+    return credentials_request(host, API_PREFIX "/auth/login", username, password);
+}
+
+char *access_request(const string &host, const char *cookie) {
+    const char *cookies[1] = {cookie};
+    return compute_get_request(host.c_str(), API_PREFIX "/library/access", NULL,
+                                cookie != NULL ? cookies : NULL, 1, NULL);
+}
+
+/*  Add If-None-Match and If-Modified-Since to a GET request, in place of
+*   its final empty line; validators too long for the message are not sent
+*/
+static char *add_conditions(char *message, const Validators *validators) {
+    if (validators == NULL || validators->empty())
+        return message;
+
+    size_t length = strlen(message);
+    size_t needed = validators->etag.size() + validators->last_modified.size() + 64;
+    if (length + needed >= BUFLEN)
+        return message;
+
+    // Drop the empty line, the conditions go before it
+    message[length - 2] = '\0';
+    if (!validators->etag.empty())
+        compute_message(message, ("If-None-Match: " + validators->etag).c_str());
+    if (!validators->last_modified.empty())
+        compute_message(message, ("If-Modified-Since: " + validators->last_modified).c_str());
+    compute_message(message, "");
+
+    return message;
+}
+
+char *books_request(const string &host, const char *token, const Validators *validators) {
+    char *message = compute_get_request(host.c_str(), API_PREFIX "/library/books", NULL, NULL, 0, token);
+    return add_conditions(message, validators);
+}
+
+char *book_request(const string &host, int id, const char *token, const Validators *validators) {
+    string url = string(API_PREFIX "/library/books/") + to_string(id);
+    char *message = compute_get_request(host.c_str(), url.c_str(), NULL, NULL, 0, token);
+    return add_conditions(message, validators);
+}
+
+/*  Post request with the details of a new book
+*   The page count is sent as a string, like the server expects
+*/
+char *add_book_request(const string &host, const Book &book, const char *token) {
+    if (!is_string_valid(book.title) || !is_string_valid(book.author) || !is_string_valid(book.genre)
+        || !is_string_valid(book.publisher) || book.page_count < 0)
+        return NULL;
+
+    char page_count[16];
+    int page_count_length = snprintf(page_count, sizeof(page_count), "%d", book.page_count);
+
+    const string_view values[] = {book.title, book.author, book.genre,
+                                  string_view(page_count, page_count_length), book.publisher};
+    return json_post_request(host, API_PREFIX "/library/books", BOOK, values, token);
+}
+
+char *delete_book_request(const string &host, int id, const char *token) {
+    string url = string(API_PREFIX "/library/books/") + to_string(id);
+    return compute_delete_request(host.c_str(), url.c_str(), NULL, NULL, 0, token);
+}
+
+char *logout_request(const string &host, const char *cookie) {
+    const char *cookies[1] = {cookie};
+    return compute_get_request(host.c_str(), API_PREFIX "/auth/logout", NULL,
+                                cookie != NULL ? cookies : NULL, 1, NULL);
+}
+
+Status register_status(const HttpResponse &response) {
+    return classify(response, Status::UsernameTaken);
+}
+
+/*  Interpret a login response, keeping the session cookie on success
+*/
+Status login_status(const HttpResponse &response, string &cookie) {
+    Status status = classify(response, Status::InvalidCredentials);
+    if (status == Status::NotFound)
+        return Status::InvalidCredentials;
+    if (status != Status::Ok)
+        return status;
+
+    string_view session = response.cookie("connect.sid");
+    if (session.empty())
+        return Status::NoResponse;
+
+    cookie = session;
+    return Status::Ok;
+}
+
+/*  Interpret a library access response, keeping the JWT token on success
+*/
+Status access_status(const HttpResponse &response, string &token) {
+    Status status = classify(response, Status::Unauthorized);
+    if (status != Status::Ok)
+        return status == Status::NotFound ? Status::Unauthorized : status;
+
+    JsonObject body(response.body);
+    if (!body.get_string("token", token))
+        return Status::NoResponse;
+
+    return Status::Ok;
+}
+
+/*  Interpret a response with all books
+*   Only the id and the title of each book are sent by the server
+*/
+Status books_status(const HttpResponse &response, vector<Book> &books) {
+    Status status = classify(response, Status::Unauthorized);
+    if (status != Status::Ok)
+        return status == Status::NotFound ? Status::Unauthorized : status;
+
+    JsonArray list(response.body);
+    if (!list.valid())
+        return Status::NoResponse;
+
+    string_view element;
+    while (list.next(element)) {
+        JsonObject entry(element);
+        Book book = {};
+        entry.get_int("id", book.id);
+        entry.get_string("title", book.title);
+        books.push_back(std::move(book));
+    }
+    return Status::Ok;
+}
+
+/*  Interpret a response with the details of a book
+*   Only the fields of the schema are looked up in the body, no DOM is built
+*/
+Status book_status(const HttpResponse &response, Book &book) {
+    Status status = classify(response, Status::Unauthorized);
+    if (status != Status::Ok)
+        return status;
+
+    JsonObject body(response.body);
+    if (!body.valid())
+        return Status::NoResponse;
+
+    body.get_int("id", book.id);
+    book.title.clear();
+    book.author.clear();
+    book.genre.clear();
+    book.publisher.clear();
+    book.page_count = 0;
+    body.get_string("title", book.title);
+    body.get_string("author", book.author);
+    body.get_string("genre", book.genre);
+    body.get_string("publisher", book.publisher);
+    body.get_count("page_count", book.page_count);
+    return Status::Ok;
+}
+
+/*  A 400 means the server rejected the details of the book
+*/
+Status add_book_status(const HttpResponse &response) {
+    if (response.status == 400)
+        return Status::InvalidInput;
+
+    Status status = classify(response, Status::Unauthorized);
+    return status == Status::NotFound ? Status::Unauthorized : status;
+}
+
+Status delete_book_status(const HttpResponse &response) {
+    return classify(response, Status::Unauthorized);
+}
+
+Status logout_status(const HttpResponse &response) {
+    Status status = classify(response, Status::Unauthorized);
+    return status == Status::NotFound ? Status::Unauthorized : status;
+}
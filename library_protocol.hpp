@@ -0,0 +1,84 @@
+#ifndef _LIBRARY_PROTOCOL_
+#define _LIBRARY_PROTOCOL_
+
+#include <string>
+#include <vector>
+#include "http_response.hpp"
+
+#define API_PREFIX "/api/v1/tema"
+
+typedef struct {
+    int id;
+    std::string title;
+    std::string author;
+    std::string genre;
+    std::string publisher;
+    int page_count;
+} Book;
+
+// validators of a response, sent back with the next request for the same
+// resource so that the server can answer 304 Not Modified without a body
+struct Validators {
+    std::string etag;               // sent as If-None-Match
+    std::string last_modified;      // sent as If-Modified-Since
+
+    bool empty() const { return etag.empty() && last_modified.empty(); }
+};
+
+// outcome of a library operation
+enum class Status {
+    Ok,
+    InvalidInput,       // rejected locally, nothing was sent
+    UsernameTaken,
+    InvalidCredentials,
+    Unauthorized,       // not logged in or no library access
+    NotFound,
+    NoResponse          // the server did not answer as expected
+};
+
+template <typename T>
+struct Result {
+    Status status;
+    T value;
+
+    bool ok() const { return status == Status::Ok; }
+};
+
+// checks if a string is a valid input (alphanumeric, underscore, dot, dash)
+bool is_string_valid(const std::string &s);
+
+// checks if a string is a valid number (digits only)
+bool is_number_valid(const std::string &s);
+
+// checks if a response means the server throttled or failed the request
+bool is_overloaded(const HttpResponse &response);
+
+// returns the ETag and Last-Modified of a response
+Validators response_validators(const HttpResponse &response);
+
+// The request builders return a message allocated like compute_*_request,
+// or NULL if the input is invalid. A NULL token or cookie is not sent, and
+// the GET requests are made conditional on validators when they are given.
+
+char *register_request(const std::string &host, const std::string &username, const std::string &password);
+char *login_request(const std::string &host, const std::string &username, const std::string &password);
+char *access_request(const std::string &host, const char *cookie);
+char *books_request(const std::string &host, const char *token, const Validators *validators = NULL);
+char *book_request(const std::string &host, int id, const char *token, const Validators *validators = NULL);
+char *add_book_request(const std::string &host, const Book &book, const char *token);
+char *delete_book_request(const std::string &host, int id, const char *token);
+char *logout_request(const std::string &host, const char *cookie);
+
+// The response parsers map the status code of a parsed response to a Status
+// and extract its payload.
+
+Status register_status(const HttpResponse &response);
+Status login_status(const HttpResponse &response, std::string &cookie);
+Status access_status(const HttpResponse &response, std::string &token);
+Status books_status(const HttpResponse &response, std::vector<Book> &books);
+Status book_status(const HttpResponse &response, Book &book);
+Status add_book_status(const HttpResponse &response);
+Status delete_book_status(const HttpResponse &response);
+Status logout_status(const HttpResponse &response);
+
+#endif
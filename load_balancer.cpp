@@ -0,0 +1,169 @@
+// Client-side load balancing over the replicas of the server
+#include <errno.h>
+#include <sys/socket.h>
+#include <random>
+#include "load_balancer.hpp"
+
+extern "C" {
+  #include "helpers.h"
+  #include "resolver.h"
+}
+
+using namespace std;
+using namespace std::chrono;
+
+// Idle connections kept per replica
+#define MAX_IDLE_CONNECTIONS 32
+
+Endpoint::Endpoint(const string &host, int port)
+    : host(host), port(port), inflight(0)
+{
+}
+
+Endpoint::~Endpoint()
+{
+    for (int sockfd : idle)
+        close_connection(sockfd);
+}
+
+/*  A pooled connection the server closed in the meantime reads as EOF (or
+*   has unexpected bytes waiting), so it is dropped instead of reused
+*/
+static bool still_open(int sockfd) {
+    char byte;
+    ssize_t bytes = recv(sockfd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int Endpoint::acquire(bool &reused)
+{
+    reused = false;
+    while (true) {
+        int sockfd;
+        {
+            lock_guard<std::mutex> lock(mutex);
+            if (idle.empty())
+                break;
+            sockfd = idle.back();
+            idle.pop_back();
+        }
+
+        if (still_open(sockfd)) {
+            reused = true;
+            return sockfd;
+        }
+        close_connection(sockfd);
+    }
+
+    return connect_host(host.c_str(), port, AF_UNSPEC);
+}
+
+void Endpoint::release(int sockfd, bool reusable)
+{
+    if (reusable) {
+        // Another thread may take it from the pool
+        release_connection(sockfd);
+        lock_guard<std::mutex> lock(mutex);
+        if (idle.size() < MAX_IDLE_CONNECTIONS) {
+            idle.push_back(sockfd);
+            return;
+        }
+    }
+    close_connection(sockfd);
+}
+
+bool Endpoint::start(long &ticket)
+{
+    if (!breaker.allow(ticket))
+        return false;
+
+    inflight++;
+    return true;
+}
+
+void Endpoint::finish(long ticket, bool ok)
+{
+    inflight--;
+    breaker.record(ticket, ok);
+}
+
+LoadBalancer::LoadBalancer(const vector<pair<string, int>> &replicas)
+{
+    for (const auto &replica : replicas)
+        endpoints.push_back(make_unique<Endpoint>(replica.first, replica.second));
+}
+
+LoadBalancer::LoadBalancer(const string &host, int port)
+{
+    endpoints.push_back(make_unique<Endpoint>(host, port));
+}
+
+/*  Draw two of the healthy replicas and keep the less loaded one; when
+*   every breaker is open they are all candidates again, and the request
+*   fails fast in Endpoint::start
+*/
+Endpoint &LoadBalancer::pick()
+{
+    Endpoint *chosen = endpoints[0].get();
+
+    if (endpoints.size() > 1) {
+        thread_local minstd_rand random(random_device{}());
+        steady_clock::time_point now = steady_clock::now();
+
+        thread_local vector<Endpoint *> healthy;
+        healthy.clear();
+        for (auto &endpoint : endpoints) {
+            if (!endpoint->ejected(now))
+                healthy.push_back(endpoint.get());
+        }
+        if (healthy.empty()) {
+            for (auto &endpoint : endpoints)
+                healthy.push_back(endpoint.get());
+        }
+
+        size_t count = healthy.size();
+        chosen = healthy[random() % count];
+        if (count > 1) {
+            size_t other = random() % (count - 1);
+            Endpoint *second = healthy[other] == chosen ? healthy[count - 1] : healthy[other];
+            if (second->outstanding() < chosen->outstanding())
+                chosen = second;
+        }
+    }
+
+    return *chosen;
+}
+
+bool LoadBalancer::available()
+{
+    steady_clock::time_point now = steady_clock::now();
+    for (auto &endpoint : endpoints) {
+        if (!endpoint->ejected(now))
+            return true;
+    }
+    return false;
+}
+
+Endpoint &LoadBalancer::next(const Endpoint &failed)
+{
+    return *endpoints[(index(failed) + 1) % endpoints.size()];
+}
+
+void LoadBalancer::configure_breakers(int failure_threshold, milliseconds open_time, int probes)
+{
+    for (auto &endpoint : endpoints)
+        endpoint->breaker.configure(failure_threshold, open_time, probes);
+}
+
+size_t LoadBalancer::index(const Endpoint &endpoint) const
+{
+    for (size_t i = 0; i < endpoints.size(); ++i) {
+        if (endpoints[i].get() == &endpoint)
+            return i;
+    }
+    return 0;
+}
+
+bool is_replica_failure(int http_status) {
+    return http_status == 0 || http_status >= 500;
+}
@@ -0,0 +1,90 @@
+#ifndef _LOAD_BALANCER_
+#define _LOAD_BALANCER_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "circuit_breaker.hpp"
+
+// one replica of the library server: its idle connections and how healthy
+// it looks from the responses it gave; shared by every thread
+class Endpoint {
+public:
+    Endpoint(const std::string &host, int port);
+    ~Endpoint();
+
+    // takes an idle connection of the pool (reused is set), or opens a new
+    // one; returns a blocking socket or -1 if the replica cannot be reached
+    int acquire(bool &reused);
+
+    // gives a connection back to the pool when reusable, closes it otherwise
+    void release(int sockfd, bool reusable);
+
+    // starts a request to this replica; returns false (and the request
+    // must fail right away) while its circuit breaker is open, otherwise
+    // sets the ticket to give back to finish
+    bool start(long &ticket);
+
+    // ends a started request; ok is false for failures that count towards
+    // the breaker (no connection, no response, 5xx)
+    void finish(long ticket, bool ok);
+
+    // requests sent to the replica and not finished yet
+    int outstanding() const { return inflight; }
+
+    // true while the replica is left out after too many failures
+    bool ejected(std::chrono::steady_clock::time_point now) { return breaker.is_open(now); }
+
+    const std::string host;
+    const int port;
+    CircuitBreaker breaker;
+
+private:
+    std::mutex mutex;
+    std::vector<int> idle;
+    std::atomic<int> inflight;
+};
+
+// spreads requests over the replicas of the server: two healthy replicas
+// are drawn at random and the one with fewer outstanding requests is used
+// (power of two choices); replicas whose circuit breaker opened are left out
+class LoadBalancer {
+public:
+    // replicas as (host, port), at least one
+    explicit LoadBalancer(const std::vector<std::pair<std::string, int>> &replicas);
+    LoadBalancer(const std::string &host, int port);
+
+    // picks the replica of the next request
+    Endpoint &pick();
+
+    // false while the breaker of every replica is open, so that a request
+    // would fail right away
+    bool available();
+
+    // failover: the replica following failed in the list
+    Endpoint &next(const Endpoint &failed);
+
+    // sets the thresholds of the breaker of every replica
+    void configure_breakers(int failure_threshold, std::chrono::milliseconds open_time, int probes);
+
+    size_t size() const { return endpoints.size(); }
+    Endpoint &operator[](size_t index) { return *endpoints[index]; }
+
+    // position of an endpoint of this balancer
+    size_t index(const Endpoint &endpoint) const;
+
+    // name of the service, sent as the Host of every request
+    const std::string &host() const { return endpoints[0]->host; }
+
+private:
+    std::vector<std::unique_ptr<Endpoint>> endpoints;
+};
+
+// true if a response counts as a failure of the replica that sent it
+bool is_replica_failure(int http_status);
+
+#endif
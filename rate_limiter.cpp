@@ -0,0 +1,239 @@
+// Client-side rate limiting: token bucket + adaptive concurrency limit
+#include <sys/eventfd.h>
+#include <algorithm>
+#include <thread>
+#include "rate_limiter.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// Vegas thresholds, in estimated queued requests
+#define QUEUE_ALPHA 3
+#define QUEUE_BETA 6
+// factor applied to the limit on errors and throttling
+#define BACKOFF_RATIO 0.5
+// after this many samples the no-load latency is measured again
+#define LATENCY_PROBE_INTERVAL 250
+
+TokenBucket::TokenBucket(double rate, double burst)
+{
+    configure(rate, burst);
+}
+
+void TokenBucket::configure(double rate, double burst)
+{
+    lock_guard<std::mutex> lock(mutex);
+    this->rate = rate;
+    this->burst = max(burst, 1.0);
+    tokens = this->burst;
+    last_refill = steady_clock::now();
+}
+
+void TokenBucket::refill(steady_clock::time_point now)
+{
+    double elapsed = duration<double>(now - last_refill).count();
+    tokens = min(burst, tokens + elapsed * rate);
+    last_refill = now;
+}
+
+/*  Take one token, sleeping until the bucket has refilled enough
+*/
+void TokenBucket::acquire()
+{
+    unique_lock<std::mutex> lock(mutex);
+    if (rate <= 0)
+        return;
+
+    while (true) {
+        refill(steady_clock::now());
+        if (tokens >= 1) {
+            tokens -= 1;
+            return;
+        }
+
+        // Sleep for the time needed to refill the missing part of a token
+        duration<double> wait((1 - tokens) / rate);
+        lock.unlock();
+        this_thread::sleep_for(wait);
+        lock.lock();
+    }
+}
+
+bool TokenBucket::try_acquire(microseconds &wait)
+{
+    lock_guard<std::mutex> lock(mutex);
+    if (rate <= 0)
+        return true;
+
+    refill(steady_clock::now());
+    if (tokens >= 1) {
+        tokens -= 1;
+        return true;
+    }
+
+    wait = duration_cast<microseconds>(duration<double>((1 - tokens) / rate)) + microseconds(1);
+    return false;
+}
+
+ConcurrencyLimiter::ConcurrencyLimiter(int initial_limit, int min_limit, int max_limit)
+    : inflight(0)
+{
+    configure(initial_limit, min_limit, max_limit);
+}
+
+void ConcurrencyLimiter::configure(int initial_limit, int min_limit, int max_limit)
+{
+    lock_guard<std::mutex> lock(mutex);
+    this->min_limit = max(min_limit, 1);
+    this->max_limit = max(max_limit, this->min_limit);
+    current_limit = clamp(initial_limit, this->min_limit, this->max_limit);
+    min_latency_us = 0;
+    samples_since_reset = 0;
+    available.notify_all();
+    wake_up();
+}
+
+/*  Non-blocking callers waiting for a slot (one eventfd per reactor) all
+*   ask again, like the blocking ones woken up by the condition variable
+*/
+void ConcurrencyLimiter::wake_up()
+{
+    for (int fd : sleepers)
+        eventfd_write(fd, 1);
+    sleepers.clear();
+}
+
+void ConcurrencyLimiter::acquire()
+{
+    unique_lock<std::mutex> lock(mutex);
+    available.wait(lock, [this] { return inflight < (int) current_limit; });
+    inflight++;
+}
+
+bool ConcurrencyLimiter::try_acquire(int wake_fd)
+{
+    lock_guard<std::mutex> lock(mutex);
+    if (inflight >= (int) current_limit) {
+        if (wake_fd >= 0 && find(sleepers.begin(), sleepers.end(), wake_fd) == sleepers.end())
+            sleepers.push_back(wake_fd);
+        return false;
+    }
+
+    inflight++;
+    return true;
+}
+
+void ConcurrencyLimiter::cancel()
+{
+    lock_guard<std::mutex> lock(mutex);
+    inflight--;
+    available.notify_all();
+    wake_up();
+}
+
+/*  Adjust the limit from the outcome of a finished request:
+*   drops halve it, otherwise the number of requests queued at the server is
+*   estimated as limit * (1 - best_latency / latency) and the limit grows
+*   while that queue is short and shrinks once it builds up
+*/
+void ConcurrencyLimiter::release(microseconds latency, bool dropped)
+{
+    lock_guard<std::mutex> lock(mutex);
+    int was_inflight = inflight--;
+
+    if (dropped) {
+        current_limit = max((double) min_limit, current_limit * BACKOFF_RATIO);
+    } else {
+        long sample = max(latency.count(), 1L);
+
+        if (min_latency_us == 0 || sample < min_latency_us || ++samples_since_reset >= LATENCY_PROBE_INTERVAL) {
+            min_latency_us = sample;
+            samples_since_reset = 0;
+        }
+
+        double queue = current_limit * (1 - (double) min_latency_us / sample);
+
+        // Only grow when the current limit is actually in use
+        if (queue < QUEUE_ALPHA && was_inflight * 2 >= (int) current_limit) {
+            current_limit = min((double) max_limit, current_limit + 1);
+        } else if (queue > QUEUE_BETA) {
+            current_limit = max((double) min_limit, current_limit - 1);
+        }
+    }
+
+    available.notify_all();
+    wake_up();
+}
+
+int ConcurrencyLimiter::limit()
+{
+    lock_guard<std::mutex> lock(mutex);
+    return (int) current_limit;
+}
+
+int ConcurrencyLimiter::in_flight()
+{
+    lock_guard<std::mutex> lock(mutex);
+    return inflight;
+}
+
+RateLimiter::Permit::Permit(ConcurrencyLimiter *limiter)
+    : limiter(limiter), start(steady_clock::now())
+{
+}
+
+RateLimiter::Permit::Permit(Permit &&other)
+    : limiter(other.limiter), start(other.start)
+{
+    other.limiter = nullptr;
+}
+
+/*  A permit that was never completed counts as a failed request
+*/
+RateLimiter::Permit::~Permit()
+{
+    complete(false);
+}
+
+void RateLimiter::Permit::complete(bool ok)
+{
+    if (limiter == nullptr)
+        return;
+
+    limiter->release(duration_cast<microseconds>(steady_clock::now() - start), !ok);
+    limiter = nullptr;
+}
+
+void RateLimiter::Permit::cancel()
+{
+    if (limiter == nullptr)
+        return;
+
+    limiter->cancel();
+    limiter = nullptr;
+}
+
+RateLimiter::Permit RateLimiter::acquire()
+{
+    bucket.acquire();
+    concurrency.acquire();
+    return Permit(&concurrency);
+}
+
+/*  Take the slot first, so that a token is never spent on a request that
+*   cannot be sent yet
+*/
+optional<RateLimiter::Permit> RateLimiter::try_acquire(microseconds &wait, int wake_fd)
+{
+    if (!concurrency.try_acquire(wake_fd)) {
+        wait = microseconds(0);
+        return nullopt;
+    }
+
+    if (!bucket.try_acquire(wait)) {
+        concurrency.cancel();
+        return nullopt;
+    }
+
+    return Permit(&concurrency);
+}
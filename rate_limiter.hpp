@@ -0,0 +1,117 @@
+#ifndef _RATE_LIMITER_
+#define _RATE_LIMITER_
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// token bucket: refills at rate tokens per second, holds at most burst tokens
+// (a rate <= 0 disables the bucket)
+class TokenBucket {
+public:
+    TokenBucket(double rate = 0, double burst = 1);
+
+    // changes the refill rate and the bucket size
+    void configure(double rate, double burst);
+
+    // blocks until a token is available and takes it
+    void acquire();
+
+    // takes a token if one is available, otherwise sets wait to the time
+    // until the next one
+    bool try_acquire(std::chrono::microseconds &wait);
+
+private:
+    void refill(std::chrono::steady_clock::time_point now);
+
+    std::mutex mutex;
+    double rate;
+    double burst;
+    double tokens;
+    std::chrono::steady_clock::time_point last_refill;
+};
+
+// adaptive limit on the number of requests in flight: grows additively while
+// latency stays close to the best observed one (Vegas-style queue estimate)
+// and backs off multiplicatively on errors, throttling or latency build-up
+class ConcurrencyLimiter {
+public:
+    ConcurrencyLimiter(int initial_limit = 4, int min_limit = 1, int max_limit = 64);
+
+    // changes the bounds of the limit
+    void configure(int initial_limit, int min_limit, int max_limit);
+
+    // blocks until a request may be sent
+    void acquire();
+
+    // takes a slot if the limit allows it, without blocking; otherwise
+    // wake_fd (an eventfd, or -1) is written to once a slot is given back,
+    // so a caller passing it must wait on it until then
+    bool try_acquire(int wake_fd = -1);
+
+    // gives back a slot that was not used, without a latency sample
+    void cancel();
+
+    // marks a request as finished; dropped is set for errors and throttling
+    void release(std::chrono::microseconds latency, bool dropped);
+
+    // returns the current limit
+    int limit();
+
+    // returns the number of requests in flight
+    int in_flight();
+
+private:
+    void wake_up();
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::vector<int> sleepers;          // eventfds of callers without a slot
+    double current_limit;
+    int min_limit;
+    int max_limit;
+    int inflight;
+    long min_latency_us;
+    int samples_since_reset;
+};
+
+// every outgoing request takes a token from the bucket and a slot from the
+// concurrency limiter; the returned permit gives the slot back
+class RateLimiter {
+public:
+    class Permit {
+    public:
+        Permit(Permit &&other);
+        ~Permit();
+
+        // reports the outcome of the request and releases the slot
+        void complete(bool ok);
+
+        // releases the slot of a request that was never sent, without
+        // touching the limit
+        void cancel();
+
+    private:
+        friend class RateLimiter;
+        explicit Permit(ConcurrencyLimiter *limiter);
+
+        ConcurrencyLimiter *limiter;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // waits for a token and a free slot
+    Permit acquire();
+
+    // returns a permit if both are available right away (for callers that
+    // cannot block); otherwise sets wait to the time until the next token,
+    // or to zero when no slot is free: wake_fd (an eventfd) is then written
+    // to once a permit gives one back
+    std::optional<Permit> try_acquire(std::chrono::microseconds &wait, int wake_fd);
+
+    TokenBucket bucket;
+    ConcurrencyLimiter concurrency;
+};
+
+#endif
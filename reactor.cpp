@@ -0,0 +1,368 @@
+// Event loop and non-blocking sockets for the coroutine API
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include "reactor.hpp"
+
+extern "C" {
+  #include "content_decoding.h"
+  #include "resolver.h"
+  #include "traffic_log.h"
+}
+
+using namespace std;
+using namespace std::chrono;
+
+#define MAX_EVENTS 64
+
+// Coroutine that starts right away and frees itself when done
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        suspend_never initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+};
+
+static Detached run_detached(Task<void> task, int *live_tasks) {
+    co_await task;
+    (*live_tasks)--;
+}
+
+Reactor::Reactor()
+    : live_tasks(0)
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+        error("ERROR creating epoll instance");
+
+    // Always watched, its event carries no coroutine
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (event_fd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, event_fd, &event) < 0)
+        error("ERROR creating notification event");
+}
+
+Reactor::~Reactor()
+{
+    close(event_fd);
+    close(epfd);
+}
+
+Reactor::IoAwaiter Reactor::readable(int fd)
+{
+    return {this, fd, EPOLLIN};
+}
+
+Reactor::IoAwaiter Reactor::writable(int fd)
+{
+    return {this, fd, EPOLLOUT};
+}
+
+Reactor::SleepAwaiter Reactor::sleep(microseconds delay)
+{
+    return {this, steady_clock::now() + delay};
+}
+
+Reactor::NotifyAwaiter Reactor::notified()
+{
+    return {this};
+}
+
+/*  Register a one-shot interest in fd, waking handle up when it fires
+*/
+void Reactor::watch(int fd, uint32_t events, coroutine_handle<> handle)
+{
+    struct epoll_event event;
+    event.events = events | EPOLLONESHOT;
+    event.data.ptr = handle.address();
+
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &event) < 0) {
+        if (errno != ENOENT || epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+            error("ERROR watching socket");
+    }
+}
+
+void Reactor::spawn(Task<void> task)
+{
+    live_tasks++;
+    run_detached(std::move(task), &live_tasks);
+}
+
+/*  Resume coroutines whose socket is ready or whose timer expired, and
+*   every coroutine waiting in notified() once the eventfd is written to,
+*   until no spawned task is left
+*/
+void Reactor::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+    vector<void *> ready;
+
+    while (live_tasks > 0) {
+        int timeout = -1;
+        if (!timers.empty()) {
+            auto left = ceil<milliseconds>(timers.top().first - steady_clock::now());
+            timeout = max(0L, (long) left.count());
+        }
+
+        int count = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+        if (count < 0 && errno != EINTR)
+            error("ERROR waiting for events");
+
+        ready.clear();
+        for (int i = 0; i < count; ++i) {
+            if (events[i].data.ptr != NULL) {
+                ready.push_back(events[i].data.ptr);
+                continue;
+            }
+
+            eventfd_t value;
+            eventfd_read(event_fd, &value);
+            ready.insert(ready.end(), notified_waiters.begin(), notified_waiters.end());
+            notified_waiters.clear();
+        }
+
+        steady_clock::time_point now = steady_clock::now();
+        while (!timers.empty() && timers.top().first <= now) {
+            ready.push_back(timers.top().second);
+            timers.pop();
+        }
+
+        for (void *address : ready)
+            coroutine_handle<>::from_address(address).resume();
+    }
+}
+
+void run_on_threads(int threads, int count, function<Task<void>(Reactor &, int)> make)
+{
+    vector<thread> workers;
+
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([t, threads, count, &make] {
+            Reactor reactor;
+            for (int i = t; i < count; i += threads)
+                reactor.spawn(make(reactor, i));
+            reactor.run();
+        });
+    }
+
+    for (thread &worker : workers)
+        worker.join();
+}
+
+AsyncConnection::AsyncConnection(Reactor &reactor, const string &host, int port)
+    : reactor(reactor), host(host), port(port), fd(-1), pending(buffer_init()), recorded_start_us(0)
+{
+}
+
+AsyncConnection::~AsyncConnection()
+{
+    close();
+    buffer_destroy(&pending);
+}
+
+void AsyncConnection::close()
+{
+    if (fd >= 0) {
+        close_connection(fd);
+        fd = -1;
+    }
+    buffer_destroy(&pending);
+    recorded_request.clear();
+}
+
+/*  Resolve the host through the resolver cache and race its addresses,
+*   waiting for the attempts on the reactor
+*/
+Task<bool> AsyncConnection::connect()
+{
+    close();
+
+    connect_race race;
+    int sockfd = connect_race_start(&race, host.c_str(), port, AF_UNSPEC);
+
+    while (sockfd == CONNECT_RACE_PENDING) {
+        if (race.wait_writable)
+            co_await reactor.writable(race.wait_fd);
+        else
+            co_await reactor.readable(race.wait_fd);
+        sockfd = connect_race_step(&race);
+    }
+
+    fd = sockfd;
+    co_return fd >= 0;
+}
+
+Task<bool> AsyncConnection::send(const char *message, size_t size)
+{
+    size_t sent = 0;
+
+    while (sent < size) {
+        ssize_t bytes = ::send(fd, message + sent, size - sent, MSG_NOSIGNAL);
+
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            co_await reactor.writable(fd);
+            continue;
+        }
+        if (bytes <= 0)
+            co_return false;
+
+        sent += bytes;
+    }
+
+    // A request sent in several parts starts with the first one
+    if (traffic_recording()) {
+        if (recorded_request.empty())
+            recorded_start_us = traffic_clock_us();
+        recorded_request.append(message, size);
+    }
+    co_return true;
+}
+
+void AsyncConnection::record(size_t size)
+{
+    if (!recorded_request.empty())
+        traffic_record_exchange(recorded_start_us, recorded_request.data(), recorded_request.size(),
+                                pending.data, size);
+    recorded_request.clear();
+}
+
+/*  The bytes of the response are not copied: pending gives its storage to
+*   the response and only the (usually empty) rest after it moves to a new buffer
+*   Returns an empty response, closing the connection, if memory runs out
+*/
+Response AsyncConnection::take_pending(size_t size)
+{
+    buffer rest = buffer_init();
+    if ((pending.size > size && buffer_add(&rest, pending.data + size, pending.size - size) < 0)
+        || buffer_reserve(&pending, 1) == NULL) {
+        buffer_destroy(&rest);
+        close();
+        return Response();
+    }
+
+    pending.data[size] = '\0';
+    Response response(pending.data, size);
+
+    pending = rest;
+    return response;
+}
+
+/*  Hands the decoded response over and drops the first size (raw) bytes
+*   of pending; an empty response if the body was cut short
+*/
+static Response take_decoded(body_decoder &decoder, buffer &pending, size_t size) {
+    buffer decoded;
+    if (body_decoder_finish(&decoder, &decoded) < 0)
+        return Response();
+
+    memmove(pending.data, pending.data + size, pending.size - size);
+    pending.size -= size;
+
+    char *end = buffer_reserve(&decoded, 1);
+    if (end == NULL) {
+        buffer_destroy(&decoded);
+        return Response();
+    }
+
+    *end = '\0';
+    return Response(decoded.data, decoded.size);
+}
+
+/*  Read until pending holds a whole response
+*   Responses without Content-Length end when the server closes the connection,
+*   any other one cut short by the close is a failure; an encoded body is
+*   inflated as it arrives
+*/
+Task<Response> AsyncConnection::receive()
+{
+    long total = -1;
+    size_t scanned = 0;
+    body_decoder decoder;
+    int encoded = 0;
+
+    while (true) {
+        if (!buffer_is_empty(&pending)) {
+            if (total == -1) {
+                total = http_response_scan(&pending, &scanned);
+                if (total != -1 && (encoded = body_decoder_start(&decoder, &pending)) < 0)
+                    break;
+            }
+
+            // Bytes of the next (pipelined) response are left alone
+            size_t end = total >= 0 && pending.size > (size_t) total ? total : pending.size;
+            if (encoded && body_decoder_update(&decoder, &pending, end) < 0)
+                break;
+
+            if (total >= 0 && pending.size >= (size_t) total) {
+                record(total);
+                co_return encoded ? take_decoded(decoder, pending, total) : take_pending(total);
+            }
+        }
+
+        // Read straight into pending, all the rest at once when its size is known
+        size_t wanted = total > 0 && (size_t) total > pending.size ? total - pending.size : BUFLEN;
+        char *space = buffer_reserve(&pending, wanted + 1);
+        if (space == NULL)
+            break;
+        ssize_t bytes = read(fd, space, wanted);
+
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            co_await reactor.readable(fd);
+            continue;
+        }
+
+        if (bytes <= 0) {
+            // The server closed the connection, which only ends a response without Content-Length
+            Response response;
+            if (bytes == 0 && total == -2) {
+                record(pending.size);
+                response = encoded ? take_decoded(decoder, pending, pending.size) : take_pending(pending.size);
+            } else if (encoded) {
+                body_decoder_abort(&decoder);
+            }
+            close();
+            co_return response;
+        }
+
+        pending.size += bytes;
+    }
+
+    // The encoded body is not valid, or the response does not fit in memory
+    if (encoded)
+        body_decoder_abort(&decoder);
+    close();
+    co_return Response();
+}
+
+Task<Response> AsyncConnection::request(const char *message, size_t size)
+{
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool reused = is_open();
+
+        if (!reused && !co_await connect())
+            co_return Response();
+
+        if (co_await send(message, size)) {
+            Response response = co_await receive();
+            if (response.http().status != 0)
+                co_return response;
+        }
+
+        close();
+        if (!reused)
+            break;
+    }
+
+    co_return Response();
+}
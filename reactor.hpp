@@ -0,0 +1,154 @@
+#ifndef _REACTOR_
+#define _REACTOR_
+
+#include <stdint.h>
+#include <chrono>
+#include <coroutine>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+#include "http_response.hpp"
+#include "task.hpp"
+
+extern "C" {
+  #include "helpers.h"
+}
+
+// single-threaded event loop: coroutines suspend on socket readiness or
+// timers and are resumed from run(); one reactor per thread
+class Reactor {
+public:
+    struct IoAwaiter {
+        Reactor *reactor;
+        int fd;
+        uint32_t events;
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { reactor->watch(fd, events, handle); }
+        void await_resume() {}
+    };
+
+    struct SleepAwaiter {
+        Reactor *reactor;
+        std::chrono::steady_clock::time_point deadline;
+
+        bool await_ready() { return deadline <= std::chrono::steady_clock::now(); }
+        void await_suspend(std::coroutine_handle<> handle) { reactor->timers.push({deadline, handle.address()}); }
+        void await_resume() {}
+    };
+
+    struct NotifyAwaiter {
+        Reactor *reactor;
+
+        bool await_ready() { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { reactor->notified_waiters.push_back(handle.address()); }
+        void await_resume() {}
+    };
+
+    Reactor();
+    ~Reactor();
+
+    // suspends until fd can be read from / written to
+    IoAwaiter readable(int fd);
+    IoAwaiter writable(int fd);
+
+    // suspends for at least delay
+    SleepAwaiter sleep(std::chrono::microseconds delay);
+
+    // suspends until notify_fd() is written to, from any thread; every
+    // coroutine waiting then resumes (e.g. to ask a shared limiter again)
+    NotifyAwaiter notified();
+
+    // eventfd behind notified()
+    int notify_fd() const { return event_fd; }
+
+    // starts a task that runs on its own; run() returns once all of them are done
+    void spawn(Task<void> task);
+
+    // runs the event loop until every spawned task finished
+    void run();
+
+    // runs a task to completion and returns its result
+    template <typename T>
+    T block_on(Task<T> task) {
+        if constexpr (std::is_void_v<T>) {
+            spawn(std::move(task));
+            run();
+        } else {
+            std::optional<T> result;
+            spawn(capture(std::move(task), &result));
+            run();
+            return std::move(*result);
+        }
+    }
+
+private:
+    typedef std::pair<std::chrono::steady_clock::time_point, void *> Timer;
+
+    template <typename T>
+    static Task<void> capture(Task<T> task, std::optional<T> *result) {
+        result->emplace(co_await task);
+    }
+
+    void watch(int fd, uint32_t events, std::coroutine_handle<> handle);
+
+    int epfd;
+    int event_fd;
+    int live_tasks;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    std::vector<void *> notified_waiters;
+};
+
+// runs count tasks made by make(reactor, index), spread over threads
+// threads that each drive their own reactor
+void run_on_threads(int threads, int count, std::function<Task<void>(Reactor &, int)> make);
+
+// non-blocking connection to a server; keeps bytes received past the end of
+// a response for the next one, so requests can be pipelined
+class AsyncConnection {
+public:
+    AsyncConnection(Reactor &reactor, const std::string &host, int port);
+    ~AsyncConnection();
+
+    // connects to the server, returns false on failure
+    Task<bool> connect();
+
+    // sends size bytes of message, returns false on failure
+    Task<bool> send(const char *message, size_t size);
+
+    // returns the next response, empty (status 0) if the connection failed
+    // before it arrived
+    Task<Response> receive();
+
+    // sends a request and returns its response, reconnecting once when a
+    // reused connection turns out to be closed by the server
+    Task<Response> request(const char *message, size_t size);
+
+    bool is_open() const { return fd >= 0; }
+    void close();
+
+    Reactor &reactor;
+
+private:
+    // hands the first size bytes of pending over to a response
+    Response take_pending(size_t size);
+
+    // writes the request sent and the first size bytes of pending (the
+    // response as received) to the traffic log, when recording
+    void record(size_t size);
+
+    std::string host;
+    int port;
+    int fd;
+    buffer pending;
+
+    // request on its way while traffic is recorded: exchanges of many
+    // connections interleave on the reactor thread
+    std::string recorded_request;
+    uint64_t recorded_start_us;
+};
+
+#endif
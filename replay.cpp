@@ -0,0 +1,186 @@
+// Replay server: answers the client with the responses of a traffic log
+// recorded with --record, so it can be profiled without the real server
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "http_response.hpp"
+
+extern "C" {
+  #include "helpers.h"
+  #include "traffic_log.h"
+}
+
+using namespace std;
+using namespace std::chrono;
+
+#define DEFAULT_REPLAY_PORT 8080
+
+static const char NOT_RECORDED[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+
+struct Recorded {
+    string response;
+    microseconds latency;
+};
+
+// responses recorded for one request line, handed out in recorded order
+// and from the start again once they are used up
+struct Script {
+    vector<Recorded> responses;
+    size_t next = 0;
+};
+
+static unordered_map<string, Script> scripts;
+static mutex scripts_mutex;
+static double speed = 1;
+
+/*  Load every exchange of the log, keyed by the request line
+*   Returns the number of exchanges or -1 if the log cannot be read
+*/
+static long load(const char *path) {
+    traffic_reader reader;
+    if (traffic_reader_open(&reader, path) < 0)
+        return -1;
+
+    traffic_exchange exchange = {{}, buffer_init(), buffer_init()};
+    long count = 0;
+    int result;
+    while ((result = traffic_reader_next(&reader, &exchange)) == 1) {
+        string_view request(exchange.request.data, exchange.request.size);
+        string line(request.substr(0, request.find("\r\n")));
+        scripts[line].responses.push_back({string(exchange.response.data, exchange.response.size),
+                                           microseconds(exchange.header.latency_us)});
+        count++;
+    }
+
+    buffer_destroy(&exchange.request);
+    buffer_destroy(&exchange.response);
+    traffic_reader_close(&reader);
+    return result < 0 ? -1 : count;
+}
+
+static const Recorded *lookup(const string &line) {
+    lock_guard<mutex> lock(scripts_mutex);
+    auto script = scripts.find(line);
+    if (script == scripts.end())
+        return NULL;
+
+    const Recorded *recorded = &script->second.responses[script->second.next];
+    script->second.next = (script->second.next + 1) % script->second.responses.size();
+    return recorded;
+}
+
+static bool send_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t bytes = send(fd, data, size, MSG_NOSIGNAL);
+        if (bytes <= 0)
+            return false;
+        data += bytes;
+        size -= bytes;
+    }
+    return true;
+}
+
+/*  Serve the requests of one connection until the client closes it, each
+*   after the recorded latency divided by the speed
+*/
+static void serve(int fd) {
+    buffer received = buffer_init();
+
+    while (true) {
+        int header_end = buffer_find(&received, "\r\n\r\n", 4);
+        long total = header_end < 0 ? -1 : http_response_length(&received);
+        if (total == -2)
+            total = header_end + 4;
+
+        if (total < 0 || received.size < (size_t) total) {
+            char *space = buffer_reserve(&received, BUFLEN);
+            if (space == NULL)
+                break;
+            ssize_t bytes = read(fd, space, BUFLEN);
+            if (bytes <= 0)
+                break;
+            received.size += bytes;
+            continue;
+        }
+
+        string line(received.data, buffer_find(&received, "\r\n", 2));
+        memmove(received.data, received.data + total, received.size - total);
+        received.size -= total;
+
+        const Recorded *recorded = lookup(line);
+        if (recorded == NULL) {
+            cout << "Not recorded: " << line << endl;
+            if (!send_all(fd, NOT_RECORDED, sizeof(NOT_RECORDED) - 1))
+                break;
+            continue;
+        }
+
+        if (speed > 0)
+            this_thread::sleep_for(duration_cast<microseconds>(recorded->latency / speed));
+        if (!send_all(fd, recorded->response.data(), recorded->response.size()))
+            break;
+        // Responses without a length end with the connection, like they did
+        if (!parse_http_response(recorded->response).keep_alive)
+            break;
+    }
+
+    buffer_destroy(&received);
+    close(fd);
+}
+
+/*  Usage: replay <log> [--port=<port>] [--speed=<factor>]
+*   speed 1 waits the recorded latency before each response, 10 a tenth of
+*   it and 0 not at all
+*/
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " <log> [--port=<port>] [--speed=<factor>]" << endl;
+        return 1;
+    }
+
+    int port = DEFAULT_REPLAY_PORT;
+    for (int i = 2; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.rfind("--port=", 0) == 0) {
+            port = atoi(arg.c_str() + 7);
+        } else if (arg.rfind("--speed=", 0) == 0) {
+            speed = atof(arg.c_str() + 8);
+        } else {
+            cout << "Unknown option " << arg << endl;
+            return 1;
+        }
+    }
+
+    long count = load(argv[1]);
+    if (count < 0) {
+        cout << "Cannot read traffic log " << argv[1] << endl;
+        return 1;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0)
+        error("ERROR starting replay server");
+
+    cout << "Replaying " << count << " exchanges (" << scripts.size() << " distinct requests) on 127.0.0.1:"
+         << port << " at speed " << speed << endl;
+
+    while (true) {
+        int client = accept(fd, NULL, NULL);
+        if (client >= 0)
+            thread(serve, client).detach();
+    }
+}
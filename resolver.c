@@ -0,0 +1,471 @@
+// Name resolution with a cache, and Happy Eyeballs connects over it
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "helpers.h"
+#include "resolver.h"
+
+// getaddrinfo does not tell the TTL of the DNS records, so names are kept
+// for a fixed time instead
+#define RESOLVER_DEFAULT_TTL 60
+
+// Hosts remembered at once, the one expiring first makes room
+#define RESOLVER_CACHE_SIZE 16
+
+#define RESOLVER_HOST_SIZE 256
+
+// Longest time connect_host waits for a connection
+#define CONNECT_TIMEOUT_MS 3000
+
+// Delay before the next address is tried while the previous one is still
+// connecting (RFC 8305 recommends 250 ms)
+#define CONNECTION_ATTEMPT_DELAY_MS 250
+
+typedef struct {
+    char host[RESOLVER_HOST_SIZE];
+    int family;
+    long expires;                       // monotonic milliseconds
+    int count;
+    resolved_address addresses[RESOLVER_MAX_ADDRESSES];
+} cache_entry;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry cache[RESOLVER_CACHE_SIZE];
+static int cache_size;
+static int cache_ttl = RESOLVER_DEFAULT_TTL;
+
+static long now_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
+int parse_endpoint(const char *text, char *host, size_t host_size, int *port)
+{
+    const char *host_end;
+    const char *colon;
+
+    if (text[0] == '[') {
+        // [ipv6] or [ipv6]:port
+        text++;
+        host_end = strchr(text, ']');
+        if (host_end == NULL)
+            return -1;
+        colon = host_end[1] == ':' ? host_end + 1 : NULL;
+        if (colon == NULL && host_end[1] != '\0')
+            return -1;
+    } else {
+        // A bare IPv6 address has several colons and no port
+        colon = strchr(text, ':');
+        if (colon != NULL && strchr(colon + 1, ':') != NULL)
+            colon = NULL;
+        host_end = colon != NULL ? colon : text + strlen(text);
+    }
+
+    size_t length = host_end - text;
+    if (length == 0 || length >= host_size)
+        return -1;
+
+    if (colon != NULL) {
+        char *end;
+        long value = strtol(colon + 1, &end, 10);
+        if (colon[1] == '\0' || *end != '\0' || value <= 0 || value > 65535)
+            return -1;
+        *port = value;
+    }
+
+    memcpy(host, text, length);
+    host[length] = '\0';
+    return 0;
+}
+
+void resolver_set_ttl(int seconds)
+{
+    pthread_mutex_lock(&cache_mutex);
+    cache_ttl = seconds;
+    cache_size = 0;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void resolver_flush(void)
+{
+    pthread_mutex_lock(&cache_mutex);
+    cache_size = 0;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+static void set_port(resolved_address *address, int port)
+{
+    if (address->addr.ss_family == AF_INET6)
+        ((struct sockaddr_in6 *) &address->addr)->sin6_port = htons(port);
+    else
+        ((struct sockaddr_in *) &address->addr)->sin_port = htons(port);
+}
+
+/*  Addresses of a literal are known without asking anyone
+*/
+static int parse_literal(const char *host, int family, resolved_address *address)
+{
+    memset(address, 0, sizeof(*address));
+
+    struct sockaddr_in *v4 = (struct sockaddr_in *) &address->addr;
+    if (family != AF_INET6 && inet_pton(AF_INET, host, &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        address->length = sizeof(*v4);
+        return 1;
+    }
+
+    struct sockaddr_in6 *v6 = (struct sockaddr_in6 *) &address->addr;
+    if (family != AF_INET && inet_pton(AF_INET6, host, &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        address->length = sizeof(*v6);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*  getaddrinfo sorts the addresses by preference (RFC 6724); they are
+*   reordered so that the families alternate, starting with the preferred one
+*/
+static int resolve(const char *host, int family, resolved_address *addresses)
+{
+    struct addrinfo hints, *results;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if (getaddrinfo(host, NULL, &hints, &results) != 0)
+        return -1;
+
+    resolved_address found[2][RESOLVER_MAX_ADDRESSES];
+    int found_count[2] = {0, 0};
+    int first = -1;
+
+    for (struct addrinfo *result = results; result != NULL; result = result->ai_next) {
+        int index = result->ai_family == AF_INET6;
+        if (result->ai_family != AF_INET && result->ai_family != AF_INET6)
+            continue;
+        if (first < 0)
+            first = index;
+        if (found_count[index] == RESOLVER_MAX_ADDRESSES)
+            continue;
+
+        resolved_address *address = &found[index][found_count[index]++];
+        memset(address, 0, sizeof(*address));
+        memcpy(&address->addr, result->ai_addr, result->ai_addrlen);
+        address->length = result->ai_addrlen;
+    }
+    freeaddrinfo(results);
+
+    // Only families that cannot be connected to
+    if (first < 0)
+        return -1;
+
+    int count = 0;
+    for (int i = 0; count < RESOLVER_MAX_ADDRESSES && i < RESOLVER_MAX_ADDRESSES; ++i) {
+        if (i < found_count[first])
+            addresses[count++] = found[first][i];
+        if (count < RESOLVER_MAX_ADDRESSES && i < found_count[!first])
+            addresses[count++] = found[!first][i];
+    }
+
+    return count > 0 ? count : -1;
+}
+
+static cache_entry *cache_find(const char *host, int family, long now)
+{
+    for (int i = 0; i < cache_size; ++i) {
+        if (cache[i].family == family && cache[i].expires > now && strcmp(cache[i].host, host) == 0)
+            return &cache[i];
+    }
+    return NULL;
+}
+
+static void cache_store(const char *host, int family, const resolved_address *addresses, int count, long now)
+{
+    if (cache_ttl <= 0 || strlen(host) >= RESOLVER_HOST_SIZE)
+        return;
+
+    cache_entry *entry = &cache[0];
+    if (cache_size < RESOLVER_CACHE_SIZE) {
+        entry = &cache[cache_size++];
+    } else {
+        for (int i = 1; i < cache_size; ++i) {
+            if (cache[i].expires < entry->expires)
+                entry = &cache[i];
+        }
+    }
+
+    strcpy(entry->host, host);
+    entry->family = family;
+    entry->expires = now + cache_ttl * 1000L;
+    entry->count = count;
+    memcpy(entry->addresses, addresses, count * sizeof(resolved_address));
+}
+
+/*  Only the lookup itself runs without the lock, so two threads missing the
+*   same name at once both resolve it
+*/
+int resolver_lookup(const char *host, int port, int family, resolved_address *addresses, int max)
+{
+    resolved_address found[RESOLVER_MAX_ADDRESSES];
+    int count = parse_literal(host, family, found);
+
+    if (count == 0) {
+        long now = now_ms();
+
+        pthread_mutex_lock(&cache_mutex);
+        cache_entry *entry = cache_find(host, family, now);
+        if (entry != NULL) {
+            count = entry->count;
+            memcpy(found, entry->addresses, count * sizeof(resolved_address));
+        }
+        pthread_mutex_unlock(&cache_mutex);
+
+        if (count == 0) {
+            count = resolve(host, family, found);
+            if (count < 0)
+                return -1;
+
+            pthread_mutex_lock(&cache_mutex);
+            cache_store(host, family, found, count, now);
+            pthread_mutex_unlock(&cache_mutex);
+        }
+    }
+
+    if (count > max)
+        count = max;
+    for (int i = 0; i < count; ++i) {
+        addresses[i] = found[i];
+        set_port(&addresses[i], port);
+    }
+    return count;
+}
+
+static void arm_timer(connect_race *race)
+{
+    struct itimerspec due;
+    memset(&due, 0, sizeof(due));
+    due.it_value.tv_nsec = CONNECTION_ATTEMPT_DELAY_MS * 1000000L;
+    timerfd_settime(race->timerfd, 0, &due, NULL);
+}
+
+/*  Start connecting to the next address; the ones failing right away
+*   (e.g. no route for their family) are skipped
+*/
+static int start_attempt(connect_race *race)
+{
+    while (race->next < race->count) {
+        resolved_address *address = &race->addresses[race->next++];
+        int sockfd = socket(address->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sockfd < 0) {
+            race->error = errno;
+            continue;
+        }
+        socket_options_apply(sockfd);
+        // TCP_FASTOPEN_CONNECT makes connect() succeed before the handshake,
+        // so the first address would always win: only a lone address gets it
+        if (race->count > 1 && socket_options_get().fastopen) {
+            int off = 0;
+            setsockopt(sockfd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &off, sizeof(off));
+        }
+
+        if (connect(sockfd, (struct sockaddr *) &address->addr, address->length) == 0)
+            return sockfd;
+        if (errno != EINPROGRESS) {
+            race->error = errno;
+            close(sockfd);
+            continue;
+        }
+
+        race->attempts[race->running++] = sockfd;
+        if (race->epfd >= 0) {
+            struct epoll_event event;
+            event.events = EPOLLOUT;
+            event.data.fd = sockfd;
+            epoll_ctl(race->epfd, EPOLL_CTL_ADD, sockfd, &event);
+            arm_timer(race);
+        }
+        return CONNECT_RACE_PENDING;
+    }
+
+    return -1;
+}
+
+static void end_race(connect_race *race, int winner)
+{
+    for (int i = 0; i < race->running; ++i) {
+        if (race->attempts[i] != winner)
+            close(race->attempts[i]);
+    }
+    race->running = 0;
+
+    if (race->epfd >= 0) {
+        close(race->epfd);
+        close(race->timerfd);
+        race->epfd = race->timerfd = -1;
+    }
+}
+
+static int set_waiting(connect_race *race)
+{
+    if (race->epfd >= 0) {
+        race->wait_fd = race->epfd;
+        race->wait_writable = 0;
+    } else {
+        race->wait_fd = race->attempts[0];
+        race->wait_writable = 1;
+    }
+    return CONNECT_RACE_PENDING;
+}
+
+int connect_race_start(connect_race *race, const char *host, int port, int family)
+{
+    resolved_address addresses[RESOLVER_MAX_ADDRESSES];
+    int count = resolver_lookup(host, port, family, addresses, RESOLVER_MAX_ADDRESSES);
+    return connect_race_begin(race, addresses, count);
+}
+
+int connect_race_begin(connect_race *race, const resolved_address *addresses, int count)
+{
+    race->count = count > RESOLVER_MAX_ADDRESSES ? RESOLVER_MAX_ADDRESSES : count;
+    if (race->count > 0)
+        memcpy(race->addresses, addresses, race->count * sizeof(resolved_address));
+    race->next = 0;
+    race->running = 0;
+    race->epfd = race->timerfd = -1;
+    race->error = EHOSTUNREACH;
+
+    if (race->count <= 0)
+        return -1;
+
+    // A single address needs neither the epoll set nor the timer
+    if (race->count > 1) {
+        race->epfd = epoll_create1(EPOLL_CLOEXEC);
+        race->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (race->epfd < 0 || race->timerfd < 0) {
+            race->error = errno;
+            end_race(race, -1);
+            return -1;
+        }
+
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.fd = race->timerfd;
+        epoll_ctl(race->epfd, EPOLL_CTL_ADD, race->timerfd, &event);
+    }
+
+    return connect_race_step(race);
+}
+
+int connect_race_step(connect_race *race)
+{
+    struct pollfd polls[RESOLVER_MAX_ADDRESSES];
+    int due = race->running == 0;
+
+    // Drop the attempts that failed, a connected one ends the race
+    for (int i = 0; i < race->running; ++i) {
+        polls[i].fd = race->attempts[i];
+        polls[i].events = POLLOUT;
+    }
+    if (race->running > 0 && poll(polls, race->running, 0) > 0) {
+        int still_running = 0;
+
+        for (int i = 0; i < race->running; ++i) {
+            int sockfd = race->attempts[i];
+            if (polls[i].revents == 0) {
+                race->attempts[still_running++] = sockfd;
+                continue;
+            }
+
+            int err = 0;
+            socklen_t length = sizeof(err);
+            if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &length) == 0 && err == 0) {
+                end_race(race, sockfd);
+                return sockfd;
+            }
+            race->error = err != 0 ? err : errno;
+            close(sockfd);
+            // RFC 8305: a failed attempt starts the next one without waiting
+            due = 1;
+        }
+
+        race->running = still_running;
+    }
+
+    uint64_t expirations;
+    if (race->timerfd >= 0 && read(race->timerfd, &expirations, sizeof(expirations)) > 0)
+        due = 1;
+
+    if (due) {
+        int result = start_attempt(race);
+        if (result >= 0) {
+            end_race(race, result);
+            return result;
+        }
+    }
+
+    if (race->running == 0) {
+        end_race(race, -1);
+        errno = race->error;
+        return -1;
+    }
+    return set_waiting(race);
+}
+
+void connect_race_cancel(connect_race *race)
+{
+    end_race(race, -1);
+}
+
+/*  Wait for a started race to end, CONNECT_TIMEOUT_MS at most; the
+*   winning socket is made blocking again
+*/
+static int finish_race(connect_race *race, int sockfd)
+{
+    long deadline = now_ms() + CONNECT_TIMEOUT_MS;
+
+    while (sockfd == CONNECT_RACE_PENDING) {
+        long left = deadline - now_ms();
+        if (left <= 0) {
+            connect_race_cancel(race);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+
+        struct pollfd wait = {race->wait_fd, (short) (race->wait_writable ? POLLOUT : POLLIN), 0};
+        poll(&wait, 1, left);
+        sockfd = connect_race_step(race);
+    }
+
+    if (sockfd >= 0)
+        fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) & ~O_NONBLOCK);
+    return sockfd;
+}
+
+/*  The host is resolved through the cache and its addresses raced
+*/
+int connect_host(const char *host, int port, int family)
+{
+    connect_race race;
+    return finish_race(&race, connect_race_start(&race, host, port, family));
+}
+
+int connect_addresses(const resolved_address *addresses, int count)
+{
+    connect_race race;
+    return finish_race(&race, connect_race_begin(&race, addresses, count));
+}
@@ -0,0 +1,74 @@
+#ifndef _RESOLVER_
+#define _RESOLVER_
+
+#include <sys/socket.h>
+
+// Most addresses kept for one host
+#define RESOLVER_MAX_ADDRESSES 8
+
+// Returned by connect_race_step while the attempts are still running
+#define CONNECT_RACE_PENDING -2
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t length;
+} resolved_address;
+
+// splits "host", "host:port" or "[ipv6]:port" into host and port (port is
+// left alone if the text has none); returns -1 if it is malformed
+int parse_endpoint(const char *text, char *host, size_t host_size, int *port);
+
+// resolves host (a name or an IPv4/IPv6 address) for port into at most max
+// addresses of family (AF_INET, AF_INET6 or AF_UNSPEC for both), the two
+// families taking turns; names are cached for the resolver TTL, returns
+// the number of addresses or -1
+int resolver_lookup(const char *host, int port, int family, resolved_address *addresses, int max);
+
+// sets how long resolved names are kept, in seconds (0 disables the cache)
+void resolver_set_ttl(int seconds);
+
+// forgets every cached name
+void resolver_flush(void);
+
+// Happy Eyeballs connect: the addresses of a host are tried one after the
+// other, each one a short delay after the previous one unless it failed
+// first, and the first connection made wins
+typedef struct {
+    resolved_address addresses[RESOLVER_MAX_ADDRESSES];
+    int count;
+    int next;                           // next address to try
+    int attempts[RESOLVER_MAX_ADDRESSES];
+    int running;                        // attempts in flight
+    int epfd;                           // attempts and timer, with several addresses
+    int timerfd;                        // fires when the next attempt is due
+    int error;                          // errno of the last failed attempt
+
+    // what to wait for before the next connect_race_step:
+    // wait_fd becoming writable (wait_writable) or readable
+    int wait_fd;
+    int wait_writable;
+} connect_race;
+
+// resolves host and starts the first attempt; returns -1 if the host has
+// no address
+int connect_race_start(connect_race *race, const char *host, int port, int family);
+
+// starts a race over count addresses resolved beforehand (port included)
+int connect_race_begin(connect_race *race, const resolved_address *addresses, int count);
+
+// checks the attempts and starts the next one when it is due; returns the
+// connected (non-blocking) socket, -1 if every address failed (errno set) or
+// CONNECT_RACE_PENDING; the race is over unless it is pending
+int connect_race_step(connect_race *race);
+
+// gives up a pending race
+void connect_race_cancel(connect_race *race);
+
+// runs a race to its end, for a few seconds at most; returns a blocking
+// socket or -1 (errno set)
+int connect_host(const char *host, int port, int family);
+
+// same over addresses resolved beforehand
+int connect_addresses(const resolved_address *addresses, int count);
+
+#endif
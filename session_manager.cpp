@@ -0,0 +1,56 @@
+// Many concurrent library sessions in one process
+#include <thread>
+#include "session_manager.hpp"
+
+using namespace std;
+
+SessionManager::SessionManager(const string &host, int port, int threads)
+    : own_balancer(make_unique<LoadBalancer>(host, port)), balancer(own_balancer.get())
+{
+    for (int i = 0; i < max(threads, 1); ++i)
+        reactors.push_back(make_unique<Reactor>());
+}
+
+SessionManager::SessionManager(LoadBalancer &balancer, int threads)
+    : balancer(&balancer)
+{
+    for (int i = 0; i < max(threads, 1); ++i)
+        reactors.push_back(make_unique<Reactor>());
+}
+
+/*  New sessions go to the reactors in turn
+*/
+int SessionManager::add(const string &username, const string &password)
+{
+    int index = sessions.size();
+    Reactor &reactor = *reactors[index % reactors.size()];
+
+    sessions.push_back(make_unique<Session>(index, username, password, reactor, *balancer, &rate_limiter));
+    return index;
+}
+
+static Task<void> run_session(function<Task<Status>(Session &)> &script, Session &session, Status *result)
+{
+    *result = co_await script(session);
+}
+
+/*  Every thread drives the sessions of its reactor until they are all done
+*/
+vector<Status> SessionManager::run(function<Task<Status>(Session &)> script)
+{
+    vector<Status> results(sessions.size(), Status::NoResponse);
+    vector<thread> workers;
+
+    for (size_t r = 0; r < reactors.size(); ++r) {
+        workers.emplace_back([this, r, &script, &results] {
+            for (size_t i = r; i < sessions.size(); i += reactors.size())
+                reactors[r]->spawn(run_session(script, *sessions[i], &results[i]));
+            reactors[r]->run();
+        });
+    }
+
+    for (thread &worker : workers)
+        worker.join();
+
+    return results;
+}
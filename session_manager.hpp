@@ -0,0 +1,53 @@
+#ifndef _SESSION_MANAGER_
+#define _SESSION_MANAGER_
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "async_library_client.hpp"
+
+// one logged-in user: its own cookie, JWT and connection
+struct Session {
+    int index;
+    std::string username;
+    std::string password;
+    AsyncLibraryClient client;
+
+    Session(int index, const std::string &username, const std::string &password,
+            Reactor &reactor, LoadBalancer &balancer, RateLimiter *limiter)
+        : index(index), username(username), password(password), client(reactor, balancer, limiter) {}
+};
+
+// holds many independent sessions in one process and drives them
+// concurrently; sessions are spread over one reactor per thread and keep
+// their state (and connection) from one run to the next
+class SessionManager {
+public:
+    SessionManager(const std::string &host, int port, int threads);
+
+    // sessions spread their requests over the replicas of balancer, which
+    // must outlive the manager
+    SessionManager(LoadBalancer &balancer, int threads);
+
+    // adds a session for a user and returns its index
+    int add(const std::string &username, const std::string &password);
+
+    int size() const { return sessions.size(); }
+    Session &operator[](int index) { return *sessions[index]; }
+
+    // runs script on every session at once and returns their results
+    std::vector<Status> run(std::function<Task<Status>(Session &)> script);
+
+    // limiter shared by all sessions
+    RateLimiter &limiter() { return rate_limiter; }
+
+private:
+    std::unique_ptr<LoadBalancer> own_balancer;
+    LoadBalancer *balancer;
+    RateLimiter rate_limiter;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    std::vector<std::unique_ptr<Session>> sessions;
+};
+
+#endif
@@ -0,0 +1,273 @@
+// Stress test of the receive path: responses split into tiny segments,
+// misleading headers and bodies, responses cut short by the server, and
+// bodies of several GB; run by make stress
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+  #include "helpers.h"
+  #include "transport.h"
+}
+
+using namespace std;
+using namespace std::chrono;
+
+// Largest body sent through the receive path, past 2 GB so that every
+// size and offset has to be 64 bits (STRESS_MAX_BYTES overrides it)
+#define DEFAULT_MAX_BYTES (3ul << 30)
+
+// Pieces the feeder writes when it is not splitting on purpose
+#define BULK_SEGMENT (64 * 1024)
+
+// Largest growth of the cost per byte accepted from the smallest to the
+// largest input before the scaling is reported as not linear
+#define MAX_COST_GROWTH 3.0
+
+static bool failed = false;
+
+static long max_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void check(bool ok, const string &what) {
+    if (!ok) {
+        cout << "# FAILED: " << what << endl;
+        failed = true;
+    }
+}
+
+// One result line: case, size, segment, nanoseconds per byte, MB/s, memory high-water
+static void report(const string &name, size_t size, size_t segment, double seconds) {
+    cout << name << "\t" << size << "\t" << segment << "\t" << seconds * 1e9 / size << "\t"
+         << (long) (size / seconds / 1e6) << "\t" << max_rss_kb() << endl;
+}
+
+/*  Write header, then body_size bytes of pattern repeated, segment bytes
+*   per write, and close the connection
+*/
+static void feed(int fd, const string &header, size_t body_size, const string &pattern, size_t segment) {
+    string chunk;
+    while (chunk.size() < BULK_SEGMENT)
+        chunk += pattern;
+
+    auto write_all = [&](const char *data, size_t size) {
+        while (size > 0) {
+            ssize_t bytes = send(fd, data, min(size, segment), MSG_NOSIGNAL);
+            if (bytes <= 0)
+                return false;
+            data += bytes;
+            size -= bytes;
+        }
+        return true;
+    };
+
+    // Every piece starts at a multiple of the pattern, so the body is pattern repeated
+    size_t aligned = chunk.size() - chunk.size() % pattern.size();
+
+    // The header goes out with the start of the body, in one segment if segment allows it
+    size_t sent = min(body_size, aligned);
+    string first = header + chunk.substr(0, sent);
+    bool ok = write_all(first.data(), first.size());
+
+    while (ok && sent < body_size) {
+        size_t piece = min(body_size - sent, aligned);
+        ok = write_all(chunk.data(), piece);
+        sent += piece;
+    }
+    close(fd);
+}
+
+/*  Send a response through receive_response over a socket pair
+*   Returns the received response (empty if receive_response failed) and
+*   sets seconds to how long it took
+*/
+static string receive(const string &header, size_t body_size, const string &pattern, size_t segment,
+                      double &seconds, size_t &received) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    auto start = steady_clock::now();
+    thread feeder(feed, fds[1], header, body_size, pattern, segment);
+    char *data = receive_response(fds[0], &received);
+    feeder.join();
+    seconds = duration<double>(steady_clock::now() - start).count();
+    close_connection(fds[0]);
+
+    // Large responses are only checked at their ends, copying them would double the memory
+    string kept = data == NULL ? "" : received <= (1 << 20) ? string(data, received)
+                                                           : string(data, 64) + string(data + received - 64, 64);
+    free(data);
+    return kept;
+}
+
+static string header_with(const string &lines) {
+    return "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n" + lines + "\r\n";
+}
+
+/*  Headers and bodies made to mislead a parser that searches the whole
+*   buffer for Content-Length, sent in one segment so that the body is
+*   already in the buffer when the header is parsed
+*/
+static void stress_framing() {
+    double seconds;
+    size_t received;
+
+    // No length in the header: the response ends with the connection, the one in the body is text
+    // (with a body larger than one read, so that stopping early shows)
+    string body = "{\"text\":\"\r\nContent-Length: 5\r\n\r\n\",\"pad\":\"" + string(4 * BUFLEN, 'p') + "\"}";
+    string header = header_with("Connection: close\r\n");
+    string response = receive(header, body.size(), body, BULK_SEGMENT, seconds, received);
+    check(response == header + body, "Content-Length in the body was taken for the header");
+    report("length_in_body", received, BULK_SEGMENT, seconds);
+
+    // The length belongs to the header that is called Content-Length, not to one ending like it
+    header = header_with("X-Content-Length: 3\r\nContent-Length: " + to_string(body.size()) + "\r\n");
+    response = receive(header, body.size(), body, BULK_SEGMENT, seconds, received);
+    check(response == header + body, "X-Content-Length was taken for Content-Length");
+    report("length_in_other_header", received, BULK_SEGMENT, seconds);
+
+    // Every split of the terminator between two segments
+    for (size_t segment = 1; segment <= 3; ++segment) {
+        header = header_with("Content-Length: " + to_string(body.size()) + "\r\n");
+        response = receive(header, body.size(), body, segment, seconds, received);
+        check(response == header + body, "terminator split into segments of " + to_string(segment));
+    }
+
+    // A forged length must fail the receive, not the process
+    header = header_with("Content-Length: 999999999999999\r\n");
+    response = receive(header, 16, "x", BULK_SEGMENT, seconds, received);
+    check(response.empty(), "forged Content-Length");
+    report("forged_length", header.size() + 16, BULK_SEGMENT, seconds);
+}
+
+/*  The server closing the connection before the end of the header or of
+*   the Content-Length body: the receive fails instead of returning a
+*   partial response, with every backend available
+*/
+static void stress_cut_short() {
+    double seconds;
+    size_t received;
+    string body = string(4 * BUFLEN, 'b');
+
+    for (const char *name : {"blocking", "io_uring"}) {
+        if (transport_use(name) < 0)
+            continue;
+
+        string header = header_with("Content-Length: " + to_string(2 * body.size()) + "\r\n");
+        string response = receive(header, body.size(), body, BULK_SEGMENT, seconds, received);
+        check(response.empty(), string("closed in the middle of the body (") + name + ")");
+        report(string("closed_mid_body_") + name, header.size() + body.size(), BULK_SEGMENT, seconds);
+
+        header = "HTTP/1.1 200 OK\r\nContent-Length: 16\r\nContent-Ty";
+        response = receive(header, 0, "x", BULK_SEGMENT, seconds, received);
+        check(response.empty(), string("closed in the middle of the header (") + name + ")");
+
+        // Without Content-Length the close is the end of the response
+        header = header_with("Connection: close\r\n");
+        response = receive(header, body.size(), body, BULK_SEGMENT, seconds, received);
+        check(response == header + body, string("closed at the end of a response without length (") + name + ")");
+    }
+    transport_use(NULL);
+}
+
+/*  The header alone, grown one byte at a time, scanned after each byte
+*   like a receive loop does: the cost per byte must stay flat
+*/
+static void stress_header_scan() {
+    vector<double> costs;
+
+    for (size_t size : {16 << 10, 64 << 10, 256 << 10, 1 << 20}) {
+        string lines;
+        while (lines.size() < size)
+            lines += "X-Filler: " + string(54, 'f') + "\r\n";
+        string header = header_with(lines + "Content-Length: 0\r\n");
+
+        buffer growing = buffer_init();
+        size_t scanned = 0;
+        long total = -1;
+        auto start = steady_clock::now();
+        for (size_t i = 0; i < header.size() && total == -1; ++i) {
+            buffer_add(&growing, header.data() + i, 1);
+            total = http_response_scan(&growing, &scanned);
+        }
+        double seconds = duration<double>(steady_clock::now() - start).count();
+        buffer_destroy(&growing);
+
+        check(total == (long) header.size(), "header of " + to_string(header.size()) + " bytes");
+        report("scan_header_1byte", header.size(), 1, seconds);
+        costs.push_back(seconds / header.size());
+    }
+
+    cout << "# scan_header_1byte cost per byte grows x" << costs.back() / costs.front() << endl;
+    check(costs.back() / costs.front() < MAX_COST_GROWTH, "header scan is not linear");
+}
+
+/*  Whole responses through the receive path: one byte per segment, then
+*   bulk segments up to bodies of several GB
+*/
+static void stress_receive(size_t max_bytes) {
+    string pattern = "{\"id\":1,\"title\":\"Title\"},";
+    vector<double> costs;
+
+    for (size_t size : {64 << 10, 256 << 10, 1 << 20}) {
+        string header = header_with("Content-Length: " + to_string(size) + "\r\n");
+        double seconds;
+        size_t received;
+        receive(header, size, pattern, 1, seconds, received);
+        check(received == header.size() + size, "1-byte segments, body of " + to_string(size));
+        report("receive_1byte", received, 1, seconds);
+        costs.push_back(seconds / received);
+    }
+    cout << "# receive_1byte cost per byte grows x" << costs.back() / costs.front() << endl;
+    check(costs.back() / costs.front() < MAX_COST_GROWTH, "1-byte receive is not linear");
+
+    costs.clear();
+    vector<size_t> sizes;
+    // From 64 MB on, so that no size fits in the caches
+    for (size_t size : {64ul << 20, 1ul << 30}) {
+        if (size < max_bytes)
+            sizes.push_back(size);
+    }
+    sizes.push_back(max_bytes);
+
+    for (size_t size : sizes) {
+        string header = header_with("Content-Length: " + to_string(size) + "\r\n");
+        double seconds;
+        size_t received;
+        string ends = receive(header, size, pattern, BULK_SEGMENT, seconds, received);
+
+        check(received == header.size() + size, "body of " + to_string(size) + " bytes");
+        check(!ends.empty() && ends.back() == pattern[(size - 1) % pattern.size()],
+              "last byte of a body of " + to_string(size) + " bytes");
+        report("receive_bulk", received, BULK_SEGMENT, seconds);
+        costs.push_back(seconds / received);
+
+        // The buffer is allocated once, at its final size, so the high-water stays about the response
+        cout << "# receive_bulk of " << received << " bytes: memory high-water " << max_rss_kb() / 1024
+             << " MB (" << (double) max_rss_kb() * 1024 / received << "x the response)" << endl;
+    }
+    cout << "# receive_bulk cost per byte grows x" << costs.back() / costs.front() << endl;
+    check(costs.back() / costs.front() < MAX_COST_GROWTH, "bulk receive is not linear");
+}
+
+int main() {
+    const char *max = getenv("STRESS_MAX_BYTES");
+    size_t max_bytes = max != NULL ? strtoul(max, NULL, 10) : DEFAULT_MAX_BYTES;
+
+    cout << "case\tsize_bytes\tsegment_bytes\tns_per_byte\tmb_per_s\tmax_rss_kb" << endl;
+    stress_framing();
+    stress_cut_short();
+    stress_header_scan();
+    stress_receive(max_bytes);
+
+    cout << (failed ? "# some checks FAILED" : "# all checks passed") << endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,167 @@
+// Work-stealing thread pool for bulk operations
+#include "thread_pool.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// Index of the worker running on this thread, -1 outside the pool
+static thread_local int current_worker = -1;
+static thread_local ThreadPool *current_pool = nullptr;
+
+ThreadPool::ThreadPool(int threads)
+    : queued(0), pending(0), next_worker(0), stopping(false), stats_start(steady_clock::now())
+{
+    for (int i = 0; i < max(threads, 1); ++i)
+        workers.push_back(make_unique<Worker>());
+
+    for (int i = 0; i < (int) workers.size(); ++i)
+        this->threads.emplace_back(&ThreadPool::run, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(state_mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+
+    for (thread &t : threads)
+        t.join();
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+    int index;
+    {
+        // Counted before the task is visible, so that a worker finishing it
+        // cannot bring pending to 0 while it is still being submitted
+        lock_guard<mutex> lock(state_mutex);
+        index = current_pool == this ? current_worker : next_worker++ % workers.size();
+        queued++;
+        pending++;
+    }
+
+    {
+        lock_guard<mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    work_available.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    unique_lock<mutex> lock(state_mutex);
+    all_done.wait(lock, [this] { return pending == 0; });
+}
+
+void ThreadPool::parallel_for(int count, const function<void(int)> &fn)
+{
+    for (int i = 0; i < count; ++i)
+        submit([&fn, i] { fn(i); });
+    wait();
+}
+
+/*  The owner works on the newest task of its deque
+*/
+bool ThreadPool::pop(int index, function<void()> &task)
+{
+    Worker &worker = *workers[index];
+    lock_guard<mutex> lock(worker.mutex);
+
+    if (worker.tasks.empty())
+        return false;
+
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    return true;
+}
+
+/*  Thieves take the oldest task of the first non-empty deque after their own
+*/
+bool ThreadPool::steal(int index, function<void()> &task)
+{
+    int count = workers.size();
+
+    for (int i = 1; i < count; ++i) {
+        Worker &victim = *workers[(index + i) % count];
+        lock_guard<mutex> lock(victim.mutex);
+
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::run(int index)
+{
+    current_worker = index;
+    current_pool = this;
+    Worker &worker = *workers[index];
+
+    while (true) {
+        function<void()> task;
+        bool stolen = false;
+
+        if (!pop(index, task))
+            stolen = steal(index, task);
+
+        if (!task) {
+            unique_lock<mutex> lock(state_mutex);
+            work_available.wait(lock, [this] { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+                return;
+            continue;
+        }
+
+        {
+            lock_guard<mutex> lock(state_mutex);
+            queued--;
+        }
+
+        steady_clock::time_point start = steady_clock::now();
+        task();
+        steady_clock::duration busy = steady_clock::now() - start;
+
+        {
+            lock_guard<mutex> lock(worker.mutex);
+            worker.executed++;
+            worker.stolen += stolen;
+            worker.busy += busy;
+        }
+
+        lock_guard<mutex> lock(state_mutex);
+        if (--pending == 0)
+            all_done.notify_all();
+    }
+}
+
+vector<ThreadPool::WorkerStats> ThreadPool::stats()
+{
+    vector<WorkerStats> result;
+    double elapsed = duration<double>(steady_clock::now() - stats_start).count();
+
+    for (auto &worker : workers) {
+        lock_guard<mutex> lock(worker->mutex);
+        double busy = duration<double>(worker->busy).count();
+        result.push_back({worker->executed, worker->stolen, busy, elapsed > 0 ? busy / elapsed : 0});
+    }
+
+    return result;
+}
+
+void ThreadPool::reset_stats()
+{
+    for (auto &worker : workers) {
+        lock_guard<mutex> lock(worker->mutex);
+        worker->executed = 0;
+        worker->stolen = 0;
+        worker->busy = steady_clock::duration(0);
+    }
+
+    stats_start = steady_clock::now();
+}
@@ -0,0 +1,70 @@
+#ifndef _THREAD_POOL_
+#define _THREAD_POOL_
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// work-stealing pool: every worker has its own deque, takes new work from
+// its back and, when it runs dry, steals the oldest task of another worker,
+// so slow tasks on one worker do not hold back the rest of a bulk job
+class ThreadPool {
+public:
+    struct WorkerStats {
+        long executed;          // tasks run by the worker
+        long stolen;            // tasks it took from other workers
+        double busy_seconds;    // time spent running tasks
+        double utilization;     // busy time / time since the stats were reset
+    };
+
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    // queues a task; tasks submitted from a worker go to its own deque,
+    // the others are dealt to the workers in turn
+    void submit(std::function<void()> task);
+
+    // blocks until every submitted task has finished (not to be called
+    // from a task)
+    void wait();
+
+    // runs fn(i) for i in [0, count) and waits for all of them
+    void parallel_for(int count, const std::function<void(int)> &fn);
+
+    int size() const { return workers.size(); }
+
+    std::vector<WorkerStats> stats();
+    void reset_stats();
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+        long executed = 0;
+        long stolen = 0;
+        std::chrono::steady_clock::duration busy{0};
+    };
+
+    void run(int index);
+    bool pop(int index, std::function<void()> &task);
+    bool steal(int index, std::function<void()> &task);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    std::mutex state_mutex;
+    std::condition_variable work_available;
+    std::condition_variable all_done;
+    long queued;
+    long pending;
+    unsigned next_worker;
+    bool stopping;
+    std::chrono::steady_clock::time_point stats_start;
+};
+
+#endif
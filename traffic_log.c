@@ -0,0 +1,230 @@
+// Recording of the client traffic and reading it back for replays
+#include <pthread.h>
+#include <time.h>
+#include "traffic_log.h"
+
+#define TRAFFIC_LOG_MAGIC_SIZE (sizeof(TRAFFIC_LOG_MAGIC) - 1)
+
+// Largest piece handed to zlib at once (its sizes are 32 bits)
+#define MAX_GZ_CHUNK (1u << 30)
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static gzFile log_file;
+static int recording;
+static uint64_t log_start_us;
+
+// Request of the calling thread waiting for its response, allocated on its
+// first recorded request and released when recording stops or the thread exits
+static pthread_key_t pending_key;
+static pthread_once_t pending_key_once = PTHREAD_ONCE_INIT;
+static __thread buffer *pending;
+static __thread uint64_t pending_start_us;
+
+static uint64_t now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static void free_pending(void *request)
+{
+    buffer_destroy(request);
+    free(request);
+}
+
+static void make_pending_key(void)
+{
+    pthread_key_create(&pending_key, free_pending);
+}
+
+static buffer *thread_pending(void)
+{
+    if (pending == NULL) {
+        pending = malloc(sizeof(buffer));
+        if (pending == NULL)
+            return NULL;
+        *pending = buffer_init();
+
+        pthread_once(&pending_key_once, make_pending_key);
+        pthread_setspecific(pending_key, pending);
+    }
+    return pending;
+}
+
+// Other threads release theirs the next time they send or receive
+static void release_pending(void)
+{
+    if (pending != NULL) {
+        pthread_setspecific(pending_key, NULL);
+        free_pending(pending);
+        pending = NULL;
+    }
+}
+
+int traffic_record_start(const char *path)
+{
+    pthread_mutex_lock(&log_mutex);
+    if (log_file != NULL)
+        gzclose(log_file);
+
+    // Fastest compression: the log is written while the client runs
+    log_file = gzopen(path, "wb1");
+    if (log_file != NULL && gzwrite(log_file, TRAFFIC_LOG_MAGIC, TRAFFIC_LOG_MAGIC_SIZE) != TRAFFIC_LOG_MAGIC_SIZE) {
+        gzclose(log_file);
+        log_file = NULL;
+    }
+    log_start_us = now_us();
+    __atomic_store_n(&recording, log_file != NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&log_mutex);
+
+    return log_file != NULL ? 0 : -1;
+}
+
+void traffic_record_stop(void)
+{
+    pthread_mutex_lock(&log_mutex);
+    __atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+    if (log_file != NULL) {
+        gzclose(log_file);
+        log_file = NULL;
+    }
+    pthread_mutex_unlock(&log_mutex);
+
+    release_pending();
+}
+
+void traffic_record_request(const char *data, size_t size)
+{
+    if (!__atomic_load_n(&recording, __ATOMIC_ACQUIRE)) {
+        release_pending();
+        return;
+    }
+
+    buffer *request = thread_pending();
+    if (request == NULL)
+        return;
+
+    // A request sent in several parts starts with the first one
+    if (request->size == 0)
+        pending_start_us = now_us();
+    // Without memory for it the exchange is left out of the log
+    if (buffer_add(request, data, size) < 0)
+        request->size = 0;
+}
+
+// Write all of data, in pieces zlib can take
+static void write_part(gzFile file, const char *data, size_t size)
+{
+    while (size > 0) {
+        unsigned chunk = size < MAX_GZ_CHUNK ? size : MAX_GZ_CHUNK;
+        if (gzwrite(file, data, chunk) <= 0)
+            return;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static void write_exchange(uint64_t start_us, const char *request, size_t request_size,
+                           const char *response, size_t response_size)
+{
+    traffic_record_header header = {
+        start_us - log_start_us, now_us() - start_us, request_size, response_size
+    };
+
+    pthread_mutex_lock(&log_mutex);
+    if (log_file != NULL) {
+        write_part(log_file, (const char *) &header, sizeof(header));
+        write_part(log_file, request, request_size);
+        write_part(log_file, response, response_size);
+    }
+    pthread_mutex_unlock(&log_mutex);
+}
+
+void traffic_record_response(const char *data, size_t size)
+{
+    if (!__atomic_load_n(&recording, __ATOMIC_ACQUIRE)) {
+        release_pending();
+        return;
+    }
+
+    if (pending != NULL && pending->size > 0 && data != NULL)
+        write_exchange(pending_start_us, pending->data, pending->size, data, size);
+    if (pending != NULL)
+        pending->size = 0;
+}
+
+int traffic_recording(void)
+{
+    return __atomic_load_n(&recording, __ATOMIC_ACQUIRE);
+}
+
+uint64_t traffic_clock_us(void)
+{
+    return now_us();
+}
+
+void traffic_record_exchange(uint64_t start_us, const char *request, size_t request_size,
+                             const char *response, size_t response_size)
+{
+    if (traffic_recording())
+        write_exchange(start_us, request, request_size, response, response_size);
+}
+
+int traffic_reader_open(traffic_reader *reader, const char *path)
+{
+    char magic[TRAFFIC_LOG_MAGIC_SIZE];
+
+    reader->file = gzopen(path, "rb");
+    if (reader->file == NULL)
+        return -1;
+
+    if (gzread(reader->file, magic, sizeof(magic)) != sizeof(magic)
+        || memcmp(magic, TRAFFIC_LOG_MAGIC, sizeof(magic)) != 0) {
+        traffic_reader_close(reader);
+        return -1;
+    }
+    return 0;
+}
+
+// Read size bytes of the log into a buffer
+static int read_part(gzFile file, buffer *part, size_t size)
+{
+    part->size = 0;
+    char *space = buffer_reserve(part, size + 1);
+    if (space == NULL)
+        return -1;
+
+    for (size_t done = 0; done < size; ) {
+        unsigned chunk = size - done < MAX_GZ_CHUNK ? size - done : MAX_GZ_CHUNK;
+        if (gzread(file, space + done, chunk) != (int) chunk)
+            return -1;
+        done += chunk;
+    }
+
+    part->size = size;
+    space[size] = '\0';
+    return 0;
+}
+
+int traffic_reader_next(traffic_reader *reader, traffic_exchange *exchange)
+{
+    int bytes = gzread(reader->file, &exchange->header, sizeof(exchange->header));
+    if (bytes == 0)
+        return 0;
+    if (bytes != sizeof(exchange->header))
+        return -1;
+
+    if (read_part(reader->file, &exchange->request, exchange->header.request_size) < 0
+        || read_part(reader->file, &exchange->response, exchange->header.response_size) < 0)
+        return -1;
+    return 1;
+}
+
+void traffic_reader_close(traffic_reader *reader)
+{
+    if (reader->file != NULL) {
+        gzclose(reader->file);
+        reader->file = NULL;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef _TRAFFIC_LOG_
+#define _TRAFFIC_LOG_
+
+#include <stdint.h>
+#include <zlib.h>
+#include "helpers.h"
+
+// Traffic log: the requests sent with send_to_server and the responses read
+// with receive_response, one record per exchange, gzip-compressed. After the
+// 8-byte magic each record is a traffic_record_header (host byte order)
+// followed by the request and the response bytes
+#define TRAFFIC_LOG_MAGIC "WLTRAF01"
+
+typedef struct {
+    uint64_t start_us;          // when the request went out, since the recording started
+    uint64_t latency_us;        // from then until the whole response was in
+    uint64_t request_size;
+    uint64_t response_size;
+} traffic_record_header;
+
+// one recorded exchange
+typedef struct {
+    traffic_record_header header;
+    buffer request;
+    buffer response;
+} traffic_exchange;
+
+// starts recording every exchange of every thread to path (replacing the
+// file); returns 0 or -1 if it cannot be written
+int traffic_record_start(const char *path);
+
+// flushes and closes the log
+void traffic_record_stop(void);
+
+// called by send_to_server after a request (or part of one) was sent
+void traffic_record_request(const char *data, size_t size);
+
+// called by the transport with a complete response as it was received
+// (before its body is decoded), or by receive_response with NULL when none
+// came (the request is then dropped)
+void traffic_record_response(const char *data, size_t size);
+
+// whether exchanges are being recorded
+int traffic_recording(void);
+
+// current time on the clock of traffic_record_exchange, in microseconds
+uint64_t traffic_clock_us(void);
+
+// records one exchange whose request the caller kept itself, for
+// connections that share a thread (the reactor); start_us comes from
+// traffic_clock_us when the request went out
+void traffic_record_exchange(uint64_t start_us, const char *request, size_t request_size,
+                             const char *response, size_t response_size);
+
+typedef struct {
+    gzFile file;
+} traffic_reader;
+
+// opens a log for reading; returns 0 or -1
+int traffic_reader_open(traffic_reader *reader, const char *path);
+
+// reads the next exchange into exchange (its buffers, set up with
+// buffer_init, are reused); returns 1, 0 at the end of the log or -1 if it
+// is damaged
+int traffic_reader_next(traffic_reader *reader, traffic_exchange *exchange);
+
+void traffic_reader_close(traffic_reader *reader);
+
+#endif
@@ -0,0 +1,621 @@
+// Socket I/O backends of the helpers: blocking read/write and io_uring
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/io_uring.h>
+#include "transport.h"
+#include "content_decoding.h"
+#include "traffic_log.h"
+
+// Submission and completion queue sizes: a request needs at most three
+// entries at once, a multishot receive may post many completions
+#define URING_ENTRIES 8
+#define URING_CQ_ENTRIES 64
+
+// Buffers the kernel picks from for the multishot receive (a power of two)
+#define RECV_BUFFERS 16
+#define RECV_BUFFER_SIZE (64 * 1024)
+#define RECV_GROUP 0
+
+// Registered buffer requests are copied into; larger ones are sent in place
+#define SEND_BUFFER_SIZE (16 * 1024)
+
+// user_data of the requests in flight
+#define SEND_ID 1
+#define RECV_ID 2
+#define CANCEL_ID 3
+
+/*
+*   Blocking backend: one read() or write() per chunk
+*/
+
+static int blocking_send(int sockfd, const char *data, size_t size)
+{
+    size_t sent = 0;
+
+    while (sent < size) {
+        // A peer that went away is reported as an error, not with SIGPIPE
+        ssize_t bytes = send(sockfd, data + sent, size - sent, MSG_NOSIGNAL);
+        if (bytes < 0)
+            return -1;
+        if (bytes == 0)
+            break;
+
+        sent += bytes;
+    }
+    return 0;
+}
+
+/*  An encoded body is inflated read by read, while the next bytes are on
+*   their way, and the decoded response replaces the raw one at the end
+*   The connection closing only ends a response without Content-Length: one
+*   cut short (in the header or the body) is a failure, not a response
+*/
+static int blocking_receive(int sockfd, buffer *response)
+{
+    size_t start = response->size;
+    long total = -1;
+    size_t scanned = 0;
+    body_decoder decoder;
+    int encoded = 0;
+
+    do {
+        // Read straight into the buffer, all the rest at once when its size is known
+        size_t wanted = total > 0 && (size_t) total > response->size ? total - response->size : BUFLEN;
+        char *space = buffer_reserve(response, wanted + 1);
+        if (space == NULL)
+            goto fail;
+
+        ssize_t bytes = read(sockfd, space, wanted);
+        if (bytes < 0)
+            goto fail;
+        if (bytes == 0) {
+            if (total != -2)
+                goto fail;
+            break;
+        }
+
+        response->size += bytes;
+
+        // The kernel falls back to delayed acknowledgements after a while
+        if (socket_options_get().quickack) {
+            int on = 1;
+            setsockopt(sockfd, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on));
+        }
+
+        // The header is only parsed until it is complete, each byte once
+        if (total == -1) {
+            total = http_response_scan(response, &scanned);
+            if (total != -1 && (encoded = body_decoder_start(&decoder, response)) < 0)
+                return -1;
+        }
+
+        if (encoded && body_decoder_update(&decoder, response, response->size) < 0)
+            goto fail;
+    } while (total < 0 || response->size < (size_t) total);
+
+    traffic_record_response(response->data + start, response->size - start);
+    if (encoded) {
+        buffer decoded;
+        if (body_decoder_finish(&decoder, &decoded) < 0)
+            return -1;
+        buffer_destroy(response);
+        *response = decoded;
+    }
+    return 0;
+
+fail:
+    if (encoded)
+        body_decoder_abort(&decoder);
+    return -1;
+}
+
+// Nothing outlives a call of the blocking backend
+static void blocking_release(int sockfd)
+{
+}
+
+static const transport blocking_transport = {"blocking", blocking_send, blocking_receive, blocking_release};
+
+/*
+*   io_uring backend: one ring per thread, set up with raw system calls.
+*   A request is sent from a registered buffer and, on a new connection, a
+*   multishot receive is armed in the same submission; it stays armed for
+*   the next responses on that connection until the thread releases it. The
+*   kernel fills provided buffers as data arrives, and each wait reaps every
+*   completion posted so far
+*/
+
+typedef struct {
+    int fd;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;
+
+    char *send_buffer;
+    struct io_uring_buf_ring *buf_ring;
+    char *recv_buffers;
+
+    int send_done, send_result;
+    int recv_fd;            // socket the receive is armed on, -1 if none
+    int recv_ended, recv_result;
+    int cancel_done;
+    buffer inbox;           // received on recv_fd and not handed out yet
+    int inbox_full;         // received data did not fit in memory and was lost
+} uring;
+
+static void *map_memory(size_t size)
+{
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+static void *map_ring(int fd, size_t size, off_t offset)
+{
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+static void uring_teardown(uring *ring)
+{
+    if (ring->fd >= 0)
+        close(ring->fd);
+    if (ring->sqes != NULL)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != NULL && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring != NULL)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->send_buffer != NULL)
+        munmap(ring->send_buffer, SEND_BUFFER_SIZE);
+    if (ring->buf_ring != NULL)
+        munmap(ring->buf_ring, RECV_BUFFERS * sizeof(struct io_uring_buf));
+    if (ring->recv_buffers != NULL)
+        munmap(ring->recv_buffers, (size_t) RECV_BUFFERS * RECV_BUFFER_SIZE);
+    buffer_destroy(&ring->inbox);
+}
+
+// Give a receive buffer (back) to the kernel
+static void recycle(uring *ring, unsigned short bid)
+{
+    unsigned short tail = ring->buf_ring->tail;
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[tail & (RECV_BUFFERS - 1)];
+
+    buf->addr = (uintptr_t) (ring->recv_buffers + (size_t) bid * RECV_BUFFER_SIZE);
+    buf->len = RECV_BUFFER_SIZE;
+    buf->bid = bid;
+    __atomic_store_n(&ring->buf_ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int uring_setup(uring *ring)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->recv_fd = -1;
+    ring->inbox = buffer_init();
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_ENTRIES;
+
+    ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->fd < 0)
+        return -1;
+
+    // Map the queues (in one piece when the kernel allows it)
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = map_ring(ring->fd, ring->sq_ring_size, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == NULL)
+        return -1;
+    ring->cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? ring->sq_ring
+                    : map_ring(ring->fd, ring->cq_ring_size, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = map_ring(ring->fd, ring->sqes_size, IORING_OFF_SQES);
+    if (ring->cq_ring == NULL || ring->sqes == NULL)
+        return -1;
+
+    char *sq = ring->sq_ring, *cq = ring->cq_ring;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    // Send buffer, pinned once instead of on every request
+    ring->send_buffer = map_memory(SEND_BUFFER_SIZE);
+    if (ring->send_buffer == NULL)
+        return -1;
+    struct iovec iov = {ring->send_buffer, SEND_BUFFER_SIZE};
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+        return -1;
+
+    // Receive buffers, handed to the kernel through a buffer ring
+    ring->buf_ring = map_memory(RECV_BUFFERS * sizeof(struct io_uring_buf));
+    ring->recv_buffers = map_memory((size_t) RECV_BUFFERS * RECV_BUFFER_SIZE);
+    if (ring->buf_ring == NULL || ring->recv_buffers == NULL)
+        return -1;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t) ring->buf_ring;
+    reg.ring_entries = RECV_BUFFERS;
+    reg.bgid = RECV_GROUP;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return -1;
+
+    for (unsigned short bid = 0; bid < RECV_BUFFERS; ++bid)
+        recycle(ring, bid);
+
+    return 0;
+}
+
+static struct io_uring_sqe *uring_sqe(uring *ring)
+{
+    unsigned index = (*ring->sq_tail + ring->to_submit) & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->to_submit++;
+    return sqe;
+}
+
+/*  Submit the queued requests and, if wait is set, block until at least
+*   one completion is posted, all in one system call
+*/
+static int uring_enter(uring *ring, unsigned wait)
+{
+    unsigned submit = ring->to_submit;
+
+    if (submit > 0) {
+        __atomic_store_n(ring->sq_tail, *ring->sq_tail + submit, __ATOMIC_RELEASE);
+        ring->to_submit = 0;
+    }
+
+    while (syscall(__NR_io_uring_enter, ring->fd, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0) {
+        if (errno != EINTR)
+            return -1;
+        // Whatever the kernel did not take yet is submitted again
+        submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    }
+    return 0;
+}
+
+/*  Handle one completion, returns 0 if none was posted
+*   Received data is appended to the inbox and its buffer recycled at once
+*/
+static int uring_reap(uring *ring)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+    if (cqe->user_data == SEND_ID) {
+        ring->send_done = 1;
+        ring->send_result = cqe->res;
+    } else if (cqe->user_data == RECV_ID) {
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            if (cqe->res > 0 && buffer_add(&ring->inbox, ring->recv_buffers + (size_t) bid * RECV_BUFFER_SIZE, cqe->res) < 0)
+                ring->inbox_full = 1;
+            recycle(ring, bid);
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            ring->recv_ended = 1;
+            ring->recv_result = cqe->res;
+        }
+    } else if (cqe->user_data == CANCEL_ID) {
+        ring->cancel_done = 1;
+    }
+
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Handle completions until flag is set
+static int uring_wait(uring *ring, int *flag)
+{
+    while (!*flag) {
+        if (!uring_reap(ring) && uring_enter(ring, 1) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void arm_receive(uring *ring, int sockfd)
+{
+    struct io_uring_sqe *sqe = uring_sqe(ring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sockfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_GROUP;
+    sqe->user_data = RECV_ID;
+
+    ring->recv_fd = sockfd;
+    ring->recv_ended = 0;
+    ring->recv_result = 0;
+}
+
+/*  Stop the armed receive and drop what it got but was not handed out
+*   The kernel holds on to the socket while the receive is armed, so this
+*   must happen before the socket is closed or read by another thread; the
+*   cancel and the wait for both completions usually take one system call
+*/
+static int disarm_receive(uring *ring)
+{
+    if (ring->recv_fd < 0)
+        return 0;
+
+    if (!ring->recv_ended) {
+        struct io_uring_sqe *sqe = uring_sqe(ring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = RECV_ID;
+        sqe->user_data = CANCEL_ID;
+        ring->cancel_done = 0;
+
+        if (uring_wait(ring, &ring->recv_ended) < 0 || uring_wait(ring, &ring->cancel_done) < 0)
+            return -1;
+    }
+
+    ring->recv_fd = -1;
+    ring->inbox.size = 0;
+    ring->inbox_full = 0;
+    return 0;
+}
+
+/*  Multishot receives came after provided buffer rings (Linux 6.0, not
+*   5.19): arm one on a socket pair and close its other end, a kernel that
+*   knows them ends it with EOF instead of -EINVAL
+*/
+static int probe_multishot(uring *ring)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        return -1;
+
+    arm_receive(ring, fds[0]);
+    int result = uring_enter(ring, 0);
+    close(fds[1]);
+    if (result == 0)
+        result = uring_wait(ring, &ring->recv_ended);
+    close(fds[0]);
+
+    ring->recv_fd = -1;
+    return result < 0 || ring->recv_result < 0 ? -1 : 0;
+}
+
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static __thread uring *thread_uring;
+static __thread int thread_uring_failed;
+
+static void free_ring(void *ring)
+{
+    uring_teardown(ring);
+    free(ring);
+}
+
+static void make_ring_key(void)
+{
+    pthread_key_create(&ring_key, free_ring);
+}
+
+/*  Ring of the calling thread, set up on first use; NULL if the kernel
+*   refuses one or has no multishot receive, the thread then stays on the
+*   blocking backend
+*/
+static uring *thread_ring(void)
+{
+    if (thread_uring == NULL && !thread_uring_failed) {
+        uring *ring = malloc(sizeof(uring));
+        if (uring_setup(ring) < 0 || probe_multishot(ring) < 0) {
+            free_ring(ring);
+            thread_uring_failed = 1;
+            return NULL;
+        }
+
+        pthread_once(&ring_key_once, make_ring_key);
+        pthread_setspecific(ring_key, ring);
+        thread_uring = ring;
+    }
+    return thread_uring;
+}
+
+static int uring_send(int sockfd, const char *data, size_t size)
+{
+    uring *ring = thread_ring();
+    if (ring == NULL)
+        return blocking_send(sockfd, data, size);
+
+    // A receive armed on another socket is left for this one, with what it got
+    if (ring->recv_fd != sockfd && disarm_receive(ring) < 0)
+        return -1;
+
+    size_t sent = 0;
+    while (sent < size) {
+        size_t chunk = size - sent;
+        struct io_uring_sqe *sqe = uring_sqe(ring);
+
+        if (chunk <= SEND_BUFFER_SIZE) {
+            memcpy(ring->send_buffer, data + sent, chunk);
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->addr = (uintptr_t) ring->send_buffer;
+            sqe->buf_index = 0;
+        } else {
+            sqe->opcode = IORING_OP_SEND;
+            sqe->addr = (uintptr_t) (data + sent);
+        }
+        sqe->fd = sockfd;
+        sqe->len = chunk;
+        sqe->user_data = SEND_ID;
+
+        // The receive of the response goes out with the first part of the request
+        if (ring->recv_fd < 0 || ring->recv_ended)
+            arm_receive(ring, sockfd);
+
+        ring->send_done = 0;
+        if (uring_wait(ring, &ring->send_done) < 0)
+            return -1;
+        if (ring->send_result < 0) {
+            errno = -ring->send_result;
+            return -1;
+        }
+        if (ring->send_result == 0)
+            break;
+
+        sent += ring->send_result;
+    }
+    return 0;
+}
+
+/*  Bytes past the end of the response stay in the inbox for the next one
+*   on the same connection; an encoded body is inflated as its completions
+*   are reaped, like the blocking backend does read by read
+*/
+static int uring_receive(int sockfd, buffer *response)
+{
+    uring *ring = thread_ring();
+    if (ring == NULL)
+        return blocking_receive(sockfd, response);
+
+    if (ring->recv_fd != sockfd) {
+        if (disarm_receive(ring) < 0)
+            return -1;
+        arm_receive(ring, sockfd);
+    }
+
+    long total = -1;
+    size_t scanned = 0;
+    body_decoder decoder;
+    int encoded = 0;
+    while (1) {
+        if (total == -1 && ring->inbox.size > 0) {
+            total = http_response_scan(&ring->inbox, &scanned);
+            if (total != -1 && (encoded = body_decoder_start(&decoder, &ring->inbox)) < 0)
+                return -1;
+        }
+
+        size_t end = total >= 0 && ring->inbox.size > (size_t) total ? (size_t) total : ring->inbox.size;
+        if (encoded && body_decoder_update(&decoder, &ring->inbox, end) < 0)
+            goto fail;
+        if (ring->inbox_full) {
+            errno = ENOMEM;
+            goto fail;
+        }
+        if (total >= 0 && ring->inbox.size >= (size_t) total)
+            break;
+
+        if (ring->recv_ended) {
+            // End of the connection, the end of the response only without
+            // Content-Length, or a failure other than running out of buffers
+            if (ring->recv_result == 0) {
+                if (total != -2)
+                    goto fail;
+                break;
+            }
+            if (ring->recv_result < 0 && ring->recv_result != -ENOBUFS) {
+                errno = -ring->recv_result;
+                goto fail;
+            }
+            arm_receive(ring, sockfd);
+        }
+
+        if (!uring_reap(ring) && uring_enter(ring, 1) < 0)
+            goto fail;
+    }
+
+    size_t size = ring->inbox.size;
+    if (total >= 0 && size > (size_t) total)
+        size = total;
+    traffic_record_response(ring->inbox.data, size);
+
+    if (encoded) {
+        buffer decoded;
+        if (body_decoder_finish(&decoder, &decoded) < 0)
+            return -1;
+        if (response->data == NULL) {
+            *response = decoded;
+        } else {
+            int added = buffer_add(response, decoded.data, decoded.size);
+            buffer_destroy(&decoded);
+            if (added < 0)
+                return -1;
+        }
+    } else if (response->data == NULL) {
+        // The inbox becomes the response without another copy, and only
+        // what came after it (usually nothing) is copied to a new inbox
+        buffer rest = buffer_init();
+        if (ring->inbox.size > size && buffer_add(&rest, ring->inbox.data + size, ring->inbox.size - size) < 0)
+            return -1;
+        *response = ring->inbox;
+        response->size = size;
+        ring->inbox = rest;
+        return 0;
+    } else if (buffer_add(response, ring->inbox.data, size) < 0) {
+        return -1;
+    }
+
+    memmove(ring->inbox.data, ring->inbox.data + size, ring->inbox.size - size);
+    ring->inbox.size -= size;
+    return 0;
+
+fail:
+    if (encoded)
+        body_decoder_abort(&decoder);
+    return -1;
+}
+
+// Called before the socket is closed or pooled for any thread
+static void uring_release(int sockfd)
+{
+    if (thread_uring != NULL && thread_uring->recv_fd == sockfd)
+        disarm_receive(thread_uring);
+}
+
+static const transport uring_transport = {"io_uring", uring_send, uring_receive, uring_release};
+
+static const transport *current_transport = &blocking_transport;
+
+int transport_use(const char *name)
+{
+    if (name == NULL || strcmp(name, "blocking") == 0) {
+        current_transport = &blocking_transport;
+        return 0;
+    }
+
+    if (strcmp(name, "io_uring") == 0 && thread_ring() != NULL) {
+        current_transport = &uring_transport;
+        return 0;
+    }
+
+    return -1;
+}
+
+const transport *transport_current(void)
+{
+    return current_transport;
+}
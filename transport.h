@@ -0,0 +1,32 @@
+#ifndef _TRANSPORT_
+#define _TRANSPORT_
+
+#include "helpers.h"
+
+// backend doing the socket I/O of send_to_server and receive_from_server
+typedef struct {
+    const char *name;
+
+    // sends size bytes of data, returns 0 or -1 on error
+    int (*send)(int sockfd, const char *data, size_t size);
+
+    // appends one HTTP response to response (everything until the server
+    // closes the connection if it has no Content-Length), with its body
+    // decoded; the bytes as they came from the socket go to
+    // traffic_record_response. Returns 0 or -1
+    int (*receive)(int sockfd, buffer *response);
+
+    // stops whatever the backend keeps going on sockfd for the calling
+    // thread; called before the socket is closed or given back to a pool
+    // other threads take connections from
+    void (*release)(int sockfd);
+} transport;
+
+// selects the backend of every thread: "blocking" (read/write), "io_uring"
+// or NULL for the default (blocking); returns -1 if it is not available
+int transport_use(const char *name);
+
+// returns the backend in use
+const transport *transport_current(void);
+
+#endif